@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusServer>
+
+#include <downloadprogressbatch.h>
+
+namespace QApt {
+
+class DownloadProgressBatchTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void testSignature();
+    void testRoundTrip_data();
+    void testRoundTrip();
+
+public slots:
+    void receive(const QDBusMessage &message);
+
+private:
+    QList<QDBusMessage> m_received;
+};
+
+void DownloadProgressBatchTest::initTestCase()
+{
+    qDBusRegisterMetaType<DownloadProgressRecord>();
+    qDBusRegisterMetaType<DownloadProgressBatch>();
+}
+
+void DownloadProgressBatchTest::testSignature()
+{
+    // Part of the D-Bus interface, so it must not change by accident
+    QCOMPARE(QDBusMetaType::typeToSignature(qMetaTypeId<DownloadProgressRecord>()),
+             "(uittsss)");
+    QCOMPARE(QDBusMetaType::typeToSignature(qMetaTypeId<DownloadProgressBatch>()),
+             "a(uittsss)");
+}
+
+void DownloadProgressBatchTest::testRoundTrip_data()
+{
+    QTest::addColumn<DownloadProgressBatch>("batch");
+
+    QTest::newRow("empty") << DownloadProgressBatch();
+
+    DownloadProgressRecord first;
+    first.id = 1;
+    first.status = 2;
+    first.fetchedSize = 1024;
+    first.fileSize = 4096;
+    first.uri = QStringLiteral("http://archive.example.org/pool/main/f/foo/foo_1.0_amd64.deb");
+    first.shortDescription = QStringLiteral("foo");
+
+    // Only the ID is sent for an item whose status did not change
+    DownloadProgressRecord update;
+    update.id = 1;
+    update.status = 2;
+    update.fetchedSize = 2048;
+    update.fileSize = 4096;
+
+    DownloadProgressRecord large;
+    large.id = 0xfffffffe;
+    large.status = 4;
+    large.fetchedSize = Q_UINT64_C(0x123456789a);
+    large.fileSize = Q_UINT64_C(0xfedcba987654);
+    large.uri = QStringLiteral("file:/var/cache/apt/archives/bar_2.0_amd64.deb");
+    large.shortDescription = QStringLiteral("bär");
+    large.statusMessage = QStringLiteral("Hash Sum mismatch");
+
+    QTest::newRow("one") << (DownloadProgressBatch() << first);
+    QTest::newRow("several") << (DownloadProgressBatch() << first << update << large);
+}
+
+void DownloadProgressBatchTest::testRoundTrip()
+{
+    QFETCH(DownloadProgressBatch, batch);
+
+    // A peer-to-peer connection marshals for real without a bus daemon
+    QDBusServer server;
+    QVERIFY(server.isConnected());
+
+    QScopedPointer<QDBusConnection> serverConnection;
+    connect(&server, &QDBusServer::newConnection, this, [&](const QDBusConnection &connection) {
+        serverConnection.reset(new QDBusConnection(connection));
+        serverConnection->connect(QString(), QStringLiteral("/"), QStringLiteral("org.kubuntu.qapt.Test"),
+                                  QStringLiteral("batch"), this, SLOT(receive(QDBusMessage)));
+    });
+
+    const QString name = QStringLiteral("batchtest-%1").arg(QTest::currentDataTag());
+    QDBusConnection client = QDBusConnection::connectToPeer(server.address(), name);
+    QVERIFY(client.isConnected());
+    QTRY_VERIFY(!serverConnection.isNull());
+
+    m_received.clear();
+    QDBusMessage signal = QDBusMessage::createSignal(QStringLiteral("/"), QStringLiteral("org.kubuntu.qapt.Test"),
+                                                     QStringLiteral("batch"));
+    signal << QVariant::fromValue(batch);
+    QVERIFY(client.send(signal));
+
+    QTRY_COMPARE(m_received.size(), 1);
+    const QDBusMessage message = m_received.first();
+    QCOMPARE(message.signature(), QStringLiteral("a(uittsss)"));
+
+    const DownloadProgressBatch received = qdbus_cast<DownloadProgressBatch>(message.arguments().first());
+    QCOMPARE(received.size(), batch.size());
+    for (int i = 0; i < batch.size(); ++i) {
+        QCOMPARE(received.at(i).id, batch.at(i).id);
+        QCOMPARE(received.at(i).status, batch.at(i).status);
+        QCOMPARE(received.at(i).fetchedSize, batch.at(i).fetchedSize);
+        QCOMPARE(received.at(i).fileSize, batch.at(i).fileSize);
+        QCOMPARE(received.at(i).uri, batch.at(i).uri);
+        QCOMPARE(received.at(i).shortDescription, batch.at(i).shortDescription);
+        QCOMPARE(received.at(i).statusMessage, batch.at(i).statusMessage);
+    }
+
+    QDBusConnection::disconnectFromPeer(name);
+}
+
+void DownloadProgressBatchTest::receive(const QDBusMessage &message)
+{
+    m_received.append(message);
+}
+
+}
+
+QTEST_MAIN(QApt::DownloadProgressBatchTest);
+
+#include "downloadprogressbatchtest.moc"
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <dpkgstatusreader.h>
+
+namespace {
+
+struct Line {
+    QString status;
+    QString package;
+    int percentage;
+    QString message;
+};
+
+QList<Line> takeLines(DpkgStatusReader &reader)
+{
+    QList<Line> lines;
+    reader.takeLines([&](const DpkgStatusLine &line) {
+        lines.append({ line.status.toString(), line.package.toString(),
+                       line.percentage(), line.message.toString() });
+    });
+
+    return lines;
+}
+
+}
+
+class DpkgStatusReaderTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testLine();
+    void testColonsInMessage();
+    void testMalformedLines();
+    void testSplitLine();
+    void testLongLine();
+    void testReadFromPipe();
+};
+
+void DpkgStatusReaderTest::testLine()
+{
+    DpkgStatusReader reader;
+    const QByteArray data("pmstatus:libfoo:42.8571:Installing libfoo (amd64)\n");
+    reader.append(data.constData(), data.size());
+
+    const QList<Line> lines = takeLines(reader);
+    QCOMPARE(lines.size(), 1);
+    QCOMPARE(lines.first().status, QStringLiteral("pmstatus"));
+    QCOMPARE(lines.first().package, QStringLiteral("libfoo"));
+    QCOMPARE(lines.first().percentage, 42);
+    QCOMPARE(lines.first().message, QStringLiteral("Installing libfoo (amd64)"));
+}
+
+void DpkgStatusReaderTest::testColonsInMessage()
+{
+    DpkgStatusReader reader;
+    const QByteArray data("pmconffile:bar:50:'/etc/bar.conf' '/etc/bar.conf.dpkg-new' 1 1\n"
+                          "pmerror:baz:75:subprocess returned error: exit status 1\n");
+    reader.append(data.constData(), data.size());
+
+    const QList<Line> lines = takeLines(reader);
+    QCOMPARE(lines.size(), 2);
+    QCOMPARE(lines.at(0).message, QStringLiteral("'/etc/bar.conf' '/etc/bar.conf.dpkg-new' 1 1"));
+    QCOMPARE(lines.at(1).package, QStringLiteral("baz"));
+    QCOMPARE(lines.at(1).message, QStringLiteral("subprocess returned error: exit status 1"));
+}
+
+void DpkgStatusReaderTest::testMalformedLines()
+{
+    DpkgStatusReader reader;
+    const QByteArray data("\n"
+                          "no colons at all\n"
+                          "pmstatus:foo\n"
+                          ":foo:10:no status\n"
+                          "pmstatus::10:no package\n"
+                          "pmstatus:foo:10:fine\n");
+    reader.append(data.constData(), data.size());
+
+    const QList<Line> lines = takeLines(reader);
+    QCOMPARE(lines.size(), 1);
+    QCOMPARE(lines.first().message, QStringLiteral("fine"));
+}
+
+void DpkgStatusReaderTest::testSplitLine()
+{
+    DpkgStatusReader reader;
+    const QByteArray data("pmstatus:foo:10:first\npmstatus:bar:20:second\n");
+
+    // Hand the data over one byte at a time, so that every line is split
+    // at every possible position
+    QList<Line> lines;
+    for (int i = 0; i < data.size(); ++i) {
+        reader.append(data.constData() + i, 1);
+        lines += takeLines(reader);
+
+        if (i < data.indexOf('\n'))
+            QVERIFY(lines.isEmpty());
+    }
+
+    QCOMPARE(lines.size(), 2);
+    QCOMPARE(lines.at(0).package, QStringLiteral("foo"));
+    QCOMPARE(lines.at(0).message, QStringLiteral("first"));
+    QCOMPARE(lines.at(1).package, QStringLiteral("bar"));
+    QCOMPARE(lines.at(1).percentage, 20);
+}
+
+void DpkgStatusReaderTest::testLongLine()
+{
+    DpkgStatusReader reader;
+    const QByteArray message(3 * 4096, 'x');
+    const QByteArray data = "pmstatus:foo:99:" + message + '\n';
+
+    // In chunks that leave a partial line in front of the buffer each time
+    // it has to grow
+    QList<Line> lines;
+    for (int i = 0; i < data.size(); i += 1000) {
+        reader.append(data.constData() + i, qMin(1000, data.size() - i));
+        lines += takeLines(reader);
+    }
+
+    QCOMPARE(lines.size(), 1);
+    QCOMPARE(lines.first().percentage, 99);
+    QCOMPARE(lines.first().message.size(), message.size());
+}
+
+void DpkgStatusReaderTest::testReadFromPipe()
+{
+    int fds[2];
+    QCOMPARE(pipe(fds), 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    DpkgStatusReader reader;
+
+    // Nothing to read yet, but the writer is still there
+    QVERIFY(reader.readFrom(fds[0]));
+    QVERIFY(takeLines(reader).isEmpty());
+
+    const QByteArray data("pmstatus:foo:10:first\npmstatus:bar:2");
+    QCOMPARE(write(fds[1], data.constData(), data.size()), ssize_t(data.size()));
+    QVERIFY(reader.readFrom(fds[0]));
+
+    QList<Line> lines = takeLines(reader);
+    QCOMPARE(lines.size(), 1);
+    QCOMPARE(lines.first().package, QStringLiteral("foo"));
+
+    const QByteArray rest("0:second\n");
+    QCOMPARE(write(fds[1], rest.constData(), rest.size()), ssize_t(rest.size()));
+    close(fds[1]);
+
+    // The rest is read before the hang-up is reported
+    QVERIFY(!reader.readFrom(fds[0]));
+    lines = takeLines(reader);
+    QCOMPARE(lines.size(), 1);
+    QCOMPARE(lines.first().percentage, 20);
+    QCOMPARE(lines.first().message, QStringLiteral("second"));
+
+    close(fds[0]);
+}
+
+QTEST_MAIN(DpkgStatusReaderTest);
+
+#include "dpkgstatusreadertest.moc"
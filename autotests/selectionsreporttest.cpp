@@ -0,0 +1,317 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QDir>
+#include <QTemporaryDir>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/strutl.h>
+
+#include <backend.h>
+
+/*
+ * Reads selections files into a Backend over a tiny APT root with three
+ * packages: alpha and gamma are installed, beta is only available.
+ */
+
+namespace {
+
+// The size of the line buffer in Backend::loadSelections()
+const int s_bufferSize = 4096;
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    return file.write(data) == data.size();
+}
+
+QByteArray packageStanza(const QByteArray &name, bool forStatus)
+{
+    QByteArray stanza;
+    stanza += "Package: " + name + '\n';
+    if (forStatus)
+        stanza += "Status: install ok installed\n";
+    stanza += "Priority: optional\n";
+    stanza += "Section: misc\n";
+    stanza += "Installed-Size: 64\n";
+    stanza += "Maintainer: QApt Tests <tests@example.org>\n";
+    stanza += "Architecture: amd64\n";
+    stanza += "Version: 1.0-1\n";
+    if (!forStatus) {
+        stanza += "Filename: pool/main/" + name + "_1.0-1_amd64.deb\n";
+        stanza += "Size: 1024\n";
+        stanza += "MD5sum: 0123456789abcdef0123456789abcdef\n";
+    }
+    stanza += "Description: test package " + name + "\n\n";
+
+    return stanza;
+}
+
+/// A selection line of exactly @p length bytes, without the newline
+QByteArray paddedLine(const QByteArray &name, const QByteArray &selection, int length)
+{
+    return name + QByteArray(length - name.size() - selection.size(), ' ') + selection;
+}
+
+}
+
+namespace QApt {
+
+class SelectionsReportTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void testApplied();
+    void testSkipped();
+    void testNothingApplied();
+    void testMissingFile();
+    void testLineLength_data();
+    void testLineLength();
+
+private:
+    QTemporaryDir m_root;
+    Backend *m_backend = nullptr;
+
+    bool createRoot();
+    QString writeSelections(const QByteArray &contents);
+};
+
+bool SelectionsReportTest::createRoot()
+{
+    if (!m_root.isValid())
+        return false;
+
+    const QByteArray root = QFile::encodeName(m_root.path());
+
+    QByteArray conf;
+    conf += "Dir \"" + root + "/\";\n";
+    conf += "Dir::State::status \"" + root + "/var/lib/dpkg/status\";\n";
+    conf += "Dir::Bin::dpkg \"/bin/false\";\n";
+    conf += "APT::Architecture \"amd64\";\n";
+    conf += "APT::Architectures { \"amd64\"; };\n";
+    conf += "Debug::NoLocking \"true\";\n";
+    conf += "Acquire::Languages \"none\";\n";
+    conf += "QApt::MetadataCache \"" + root + "/var/cache/libqapt/metadata.cache\";\n";
+    conf += "QApt::Xapian::IndexDir \"" + root + "/var/lib/apt-xapian-index/\";\n";
+
+    QDir dir(m_root.path());
+    dir.mkpath(QLatin1String("var/cache/apt/archives/partial"));
+    dir.mkpath(QLatin1String("etc/apt/apt.conf.d"));
+    dir.mkpath(QLatin1String("etc/apt/preferences.d"));
+    dir.mkpath(QLatin1String("etc/apt/sources.list.d"));
+    dir.mkpath(QLatin1String("var/lib/apt/lists/partial"));
+    dir.mkpath(QLatin1String("var/log/apt"));
+
+    const QByteArray uri = "file:" + root + "/archive/";
+    const std::string listPrefix = root.toStdString() + "/var/lib/apt/lists/";
+    const std::string dists = uri.toStdString() + "dists/test/";
+
+    QByteArray release;
+    release += "Origin: QAptTest\n";
+    release += "Label: QAptTest\n";
+    release += "Suite: test\n";
+    release += "Codename: test\n";
+    release += "Date: Thu, 01 Jan 2026 00:00:00 UTC\n";
+    release += "Architectures: amd64\n";
+    release += "Components: main\n";
+
+    QByteArray packages;
+    QByteArray status;
+    for (const QByteArray &name : { QByteArray("alpha"), QByteArray("beta"), QByteArray("gamma") }) {
+        packages += packageStanza(name, false);
+        if (name != "beta")
+            status += packageStanza(name, true);
+    }
+
+    return writeFile(m_root.path() + QLatin1String("/etc/apt/apt.conf"), conf)
+            && writeFile(m_root.path() + QLatin1String("/etc/apt/sources.list"),
+                         "deb [trusted=yes] " + uri + " test main\n")
+            && writeFile(QString::fromStdString(listPrefix + URItoFileName(dists + "Release")), release)
+            && writeFile(QString::fromStdString(listPrefix + URItoFileName(dists + "main/binary-amd64/Packages")),
+                         packages)
+            && writeFile(m_root.path() + QLatin1String("/var/lib/dpkg/status"), status);
+}
+
+QString SelectionsReportTest::writeSelections(const QByteArray &contents)
+{
+    const QString path = m_root.path() + QLatin1String("/selections");
+
+    return writeFile(path, contents) ? path : QString();
+}
+
+void SelectionsReportTest::initTestCase()
+{
+    QVERIFY(createRoot());
+
+    qputenv("APT_CONFIG", QFile::encodeName(m_root.path() + QLatin1String("/etc/apt/apt.conf")));
+}
+
+void SelectionsReportTest::init()
+{
+    // Start from a clean configuration, since init() reads the files in
+    // again and would add to the lists in it
+    delete _config;
+    _config = new Configuration;
+
+    m_backend = new Backend;
+    QVERIFY2(m_backend->init(), qPrintable(m_backend->initErrorMessage()));
+}
+
+void SelectionsReportTest::cleanup()
+{
+    delete m_backend;
+    m_backend = nullptr;
+}
+
+void SelectionsReportTest::testApplied()
+{
+    const QString path = writeSelections("# Comments and blank lines are ignored\n"
+                                         "\n"
+                                         "beta\t\t\t\t\tinstall\n"
+                                         "   alpha hold\n"
+                                         "gamma deinstall\n");
+
+    SelectionsReport report;
+    QVERIFY(m_backend->loadSelections(path, &report));
+    QCOMPARE(report.applied, 3);
+    QVERIFY(report.skipped.isEmpty());
+
+    QVERIFY(m_backend->package(QLatin1String("beta"))->state() & Package::ToInstall);
+    QVERIFY(m_backend->package(QLatin1String("alpha"))->isManuallyHeld());
+    QVERIFY(m_backend->package(QLatin1String("gamma"))->state() & Package::ToRemove);
+}
+
+void SelectionsReportTest::testSkipped()
+{
+    const QString path = writeSelections("alpha\n"
+                                         "no-such-package install\n"
+                                         "beta frobnicate\n"
+                                         "gamma deinstall\n");
+
+    SelectionsReport report;
+    QVERIFY(m_backend->loadSelections(path, &report));
+    QCOMPARE(report.applied, 1);
+    QCOMPARE(report.skipped.size(), 3);
+
+    QCOMPARE(report.skipped.at(0).line, 1);
+    QCOMPARE(report.skipped.at(0).name, QStringLiteral("alpha"));
+    QCOMPARE(report.skipped.at(0).reason, SelectionsReport::MalformedLine);
+
+    QCOMPARE(report.skipped.at(1).line, 2);
+    QCOMPARE(report.skipped.at(1).name, QStringLiteral("no-such-package"));
+    QCOMPARE(report.skipped.at(1).reason, SelectionsReport::UnknownPackage);
+
+    QCOMPARE(report.skipped.at(2).line, 3);
+    QCOMPARE(report.skipped.at(2).name, QStringLiteral("beta"));
+    QCOMPARE(report.skipped.at(2).reason, SelectionsReport::UnknownSelection);
+}
+
+void SelectionsReportTest::testNothingApplied()
+{
+    const QString path = writeSelections("# Nothing to see here\n"
+                                         "no-such-package install\n");
+
+    SelectionsReport report;
+    QVERIFY(!m_backend->loadSelections(path, &report));
+    QCOMPARE(report.applied, 0);
+    QCOMPARE(report.skipped.size(), 1);
+    QCOMPARE(report.skipped.first().line, 2);
+}
+
+void SelectionsReportTest::testMissingFile()
+{
+    // Whatever the report held before is reset
+    SelectionsReport report;
+    report.applied = 5;
+    report.skipped.append({ 1, QStringLiteral("stale"), SelectionsReport::MalformedLine });
+
+    QVERIFY(!m_backend->loadSelections(m_root.path() + QLatin1String("/no-such-file"), &report));
+    QCOMPARE(report.applied, 0);
+    QVERIFY(report.skipped.isEmpty());
+}
+
+void SelectionsReportTest::testLineLength_data()
+{
+    QTest::addColumn<QByteArray>("contents");
+    QTest::addColumn<int>("applied");
+    QTest::addColumn<QVector<int>>("malformedLines");
+
+    // A line and its newline that fill the buffer exactly still fit
+    QTest::newRow("fills the buffer")
+            << paddedLine("alpha", "hold", s_bufferSize - 2) + "\nbeta install\n"
+            << 2 << QVector<int>();
+    QTest::newRow("one byte too long")
+            << paddedLine("alpha", "hold", s_bufferSize - 1) + "\nbeta install\n"
+            << 1 << QVector<int>({ 1 });
+    // The rest of the line fills the buffer again, and only then comes the
+    // newline
+    QTest::newRow("twice the buffer")
+            << paddedLine("alpha", "hold", 2 * (s_bufferSize - 1)) + "\nbeta install\n"
+            << 1 << QVector<int>({ 1 });
+    QTest::newRow("several overlong lines")
+            << paddedLine("alpha", "hold", 10000) + "\nbeta install\n"
+               + paddedLine("gamma", "deinstall", 5000) + "\ngamma deinstall\n"
+            << 2 << QVector<int>({ 1, 3 });
+    // Without a newline at the end of the file, the last line can take up
+    // the whole buffer
+    QTest::newRow("last line fills the buffer")
+            << "beta install\n" + paddedLine("alpha", "hold", s_bufferSize - 1)
+            << 2 << QVector<int>();
+    QTest::newRow("overlong last line")
+            << "beta install\n" + paddedLine("alpha", "hold", 5000)
+            << 1 << QVector<int>({ 2 });
+}
+
+void SelectionsReportTest::testLineLength()
+{
+    QFETCH(QByteArray, contents);
+    QFETCH(int, applied);
+    QFETCH(QVector<int>, malformedLines);
+
+    const QString path = writeSelections(contents);
+
+    SelectionsReport report;
+    QCOMPARE(m_backend->loadSelections(path, &report), applied > 0);
+    QCOMPARE(report.applied, applied);
+    QCOMPARE(report.skipped.size(), malformedLines.size());
+
+    for (int i = 0; i < malformedLines.size(); ++i) {
+        QCOMPARE(report.skipped.at(i).line, malformedLines.at(i));
+        QCOMPARE(report.skipped.at(i).reason, SelectionsReport::MalformedLine);
+        QVERIFY(report.skipped.at(i).name.isEmpty());
+    }
+}
+
+}
+
+QTEST_MAIN(QApt::SelectionsReportTest);
+
+#include "selectionsreporttest.moc"
@@ -0,0 +1,497 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QDir>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/strutl.h>
+
+#undef slots
+#include <xapian.h>
+#define slots Q_SLOTS
+
+#include <backend.h>
+
+/*
+ * Measures the Backend API against a synthetic APT root, so that numbers
+ * are reproducible on any offline machine. Each data row builds its own
+ * root holding a trusted file: archive with the given number of packages,
+ * a dpkg status file with a quarter of them installed (most of those at an
+ * older version, so there is something to upgrade), APT preferences with a
+ * few pins and a Xapian index for search().
+ */
+
+namespace {
+
+const char *s_arch = "amd64";
+
+int pkgSection(int i)
+{
+    return i % 40;
+}
+
+bool isInstalled(int i)
+{
+    return i % 4 == 0;
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    return file.write(data) == data.size();
+}
+
+QByteArray packageStanza(int i, bool forStatus)
+{
+    QByteArray stanza;
+    QByteArray name = "bench-pkg" + QByteArray::number(i);
+    QByteArray version = forStatus && i % 3 ? "0.9-1" : "1.0-1";
+
+    stanza += "Package: " + name + '\n';
+    if (forStatus)
+        stanza += "Status: install ok installed\n";
+    stanza += "Priority: optional\n";
+    stanza += "Section: section" + QByteArray::number(pkgSection(i)) + '\n';
+    stanza += "Installed-Size: " + QByteArray::number(64 + i % 512) + '\n';
+    stanza += "Maintainer: QApt Benchmarks <bench@example.org>\n";
+    stanza += "Architecture: " + QByteArray(s_arch) + '\n';
+    stanza += "Version: " + version + '\n';
+
+    // A handful of dependency edges per package, so that marking and
+    // resolving have some actual work to do
+    QByteArray depends;
+    if (i > 0)
+        depends += "bench-pkg" + QByteArray::number(i / 2);
+    if (i > 2)
+        depends += ", bench-pkg" + QByteArray::number(i / 3) + " | bench-pkg" + QByteArray::number(i - 1);
+    if (!depends.isEmpty())
+        stanza += "Depends: " + depends + '\n';
+
+    if (!forStatus) {
+        stanza += "Filename: pool/main/b/" + name + '/' + name + "_1.0-1_" + s_arch + ".deb\n";
+        stanza += "Size: " + QByteArray::number(1024 + i % 4096) + '\n';
+        stanza += "MD5sum: 0123456789abcdef0123456789abcdef\n";
+    }
+
+    stanza += "Description: synthetic benchmark package " + QByteArray::number(i) + '\n';
+    stanza += " Package number " + QByteArray::number(i) + " of a generated archive\n";
+    stanza += " used to benchmark libqapt.\n";
+    stanza += '\n';
+
+    return stanza;
+}
+
+class AptRoot
+{
+public:
+    explicit AptRoot(int packageCount)
+        : m_packageCount(packageCount)
+    {
+    }
+
+    bool create();
+
+    QString path() const { return m_dir.path(); }
+    QString configFile() const { return m_dir.path() + QLatin1String("/etc/apt/apt.conf"); }
+
+private:
+    QTemporaryDir m_dir;
+    int m_packageCount;
+
+    bool createArchive();
+    bool createXapianIndex();
+};
+
+bool AptRoot::create()
+{
+    if (!m_dir.isValid())
+        return false;
+
+    const QByteArray root = QFile::encodeName(m_dir.path());
+
+    QByteArray conf;
+    conf += "Dir \"" + root + "/\";\n";
+    conf += "Dir::State::status \"" + root + "/var/lib/dpkg/status\";\n";
+    conf += "Dir::Bin::dpkg \"/bin/false\";\n";
+    conf += "APT::Architecture \"" + QByteArray(s_arch) + "\";\n";
+    conf += "APT::Architectures { \"" + QByteArray(s_arch) + "\"; };\n";
+    conf += "Debug::NoLocking \"true\";\n";
+    conf += "Acquire::Languages \"none\";\n";
+    conf += "QApt::MetadataCache \"" + root + "/var/cache/libqapt/metadata.cache\";\n";
+    conf += "QApt::Xapian::IndexDir \"" + root + "/var/lib/apt-xapian-index/\";\n";
+
+    QDir(m_dir.path()).mkpath(QLatin1String("var/cache/apt/archives/partial"));
+    QDir(m_dir.path()).mkpath(QLatin1String("etc/apt/apt.conf.d"));
+    QDir(m_dir.path()).mkpath(QLatin1String("etc/apt/preferences.d"));
+    QDir(m_dir.path()).mkpath(QLatin1String("etc/apt/sources.list.d"));
+    QDir(m_dir.path()).mkpath(QLatin1String("var/lib/apt/lists/partial"));
+    QDir(m_dir.path()).mkpath(QLatin1String("var/log/apt"));
+
+    if (!writeFile(configFile(), conf))
+        return false;
+
+    return createArchive() && createXapianIndex();
+}
+
+bool AptRoot::createArchive()
+{
+    const QByteArray root = QFile::encodeName(m_dir.path());
+    const QByteArray uri = "file:" + root + "/archive/";
+
+    if (!writeFile(m_dir.path() + QLatin1String("/etc/apt/sources.list"),
+                   "deb [trusted=yes] " + uri + " bench main\n")) {
+        return false;
+    }
+
+    // The index files are read straight out of the lists directory, under
+    // the names apt-get update would have given them
+    const std::string listPrefix = root.toStdString() + "/var/lib/apt/lists/";
+    const std::string dists = uri.toStdString() + "dists/bench/";
+    const QString releaseList = QString::fromStdString(listPrefix + URItoFileName(dists + "Release"));
+    const QString packagesList = QString::fromStdString(listPrefix + URItoFileName(dists + "main/binary-" + s_arch + "/Packages"));
+
+    QByteArray release;
+    release += "Origin: QAptBench\n";
+    release += "Label: QAptBench\n";
+    release += "Suite: bench\n";
+    release += "Codename: bench\n";
+    release += "Date: Thu, 01 Jan 2026 00:00:00 UTC\n";
+    release += "Architectures: " + QByteArray(s_arch) + '\n';
+    release += "Components: main\n";
+
+    QByteArray packages;
+    QByteArray status;
+    QByteArray preferences;
+    packages.reserve(m_packageCount * 512);
+
+    for (int i = 0; i < m_packageCount; ++i) {
+        packages += packageStanza(i, false);
+        if (isInstalled(i))
+            status += packageStanza(i, true);
+        if (i % 100 == 0) {
+            preferences += "Package: bench-pkg" + QByteArray::number(i) + '\n';
+            preferences += "Pin: version 1.0*\n";
+            preferences += "Pin-Priority: 900\n\n";
+        }
+    }
+
+    return writeFile(releaseList, release)
+            && writeFile(packagesList, packages)
+            && writeFile(m_dir.path() + QLatin1String("/var/lib/dpkg/status"), status)
+            && writeFile(m_dir.path() + QLatin1String("/etc/apt/preferences"), preferences);
+}
+
+bool AptRoot::createXapianIndex()
+{
+    const QString indexDir = m_dir.path() + QLatin1String("/var/lib/apt-xapian-index/");
+    QDir().mkpath(indexDir);
+
+    try {
+        Xapian::WritableDatabase db(QFile::encodeName(indexDir + QLatin1String("index")).toStdString(),
+                                    Xapian::DB_CREATE_OR_OVERWRITE);
+        Xapian::TermGenerator indexer;
+
+        for (int i = 0; i < m_packageCount; ++i) {
+            const std::string name = "bench-pkg" + std::to_string(i);
+            Xapian::Document doc;
+            doc.set_data(name);
+            doc.add_term("XP" + name);
+            doc.add_term("XSsection" + std::to_string(pkgSection(i)));
+            indexer.set_document(doc);
+            indexer.index_text("synthetic benchmark package " + std::to_string(i));
+            db.add_document(doc);
+        }
+        db.commit();
+    } catch (const Xapian::Error &) {
+        return false;
+    }
+
+    return writeFile(indexDir + QLatin1String("update-timestamp"), QByteArray());
+}
+
+}
+
+namespace QApt {
+
+class BackendBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void init();
+    void cleanupTestCase();
+
+    void benchmarkInit_data();
+    void benchmarkInit();
+    void benchmarkReloadCache_data();
+    void benchmarkReloadCache();
+    void benchmarkSearch_data();
+    void benchmarkSearch();
+    void benchmarkMarkPackages_data();
+    void benchmarkMarkPackages();
+    void benchmarkStateChanges_data();
+    void benchmarkStateChanges();
+    void benchmarkLoadSelections_data();
+    void benchmarkLoadSelections();
+
+private:
+    QHash<int, AptRoot *> m_roots;
+
+    void addSizeRows();
+    Backend *createBackend(int packageCount);
+    void reportPeakRss();
+};
+
+void BackendBenchmark::init()
+{
+    // The kernel only keeps one high-water mark per process, so reset it
+    // to the current RSS before each row
+    QFile clearRefs(QLatin1String("/proc/self/clear_refs"));
+    if (clearRefs.open(QIODevice::WriteOnly))
+        clearRefs.write("5");
+}
+
+void BackendBenchmark::cleanupTestCase()
+{
+    qDeleteAll(m_roots);
+    m_roots.clear();
+}
+
+void BackendBenchmark::addSizeRows()
+{
+    QTest::addColumn<int>("packageCount");
+
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("50k") << 50000;
+    QTest::newRow("150k") << 150000;
+}
+
+Backend *BackendBenchmark::createBackend(int packageCount)
+{
+    AptRoot *root = m_roots.value(packageCount);
+    if (!root) {
+        root = new AptRoot(packageCount);
+        if (!root->create()) {
+            delete root;
+            return nullptr;
+        }
+        m_roots.insert(packageCount, root);
+    }
+
+    // Start from a clean configuration, so that settings from the
+    // previous row's root don't leak into this one
+    delete _config;
+    _config = new Configuration;
+    qputenv("APT_CONFIG", QFile::encodeName(root->configFile()));
+
+    Backend *backend = new Backend;
+    if (!backend->init()) {
+        qWarning() << "Backend init failed:" << backend->initErrorMessage();
+        delete backend;
+        return nullptr;
+    }
+
+    return backend;
+}
+
+void BackendBenchmark::reportPeakRss()
+{
+    QFile status(QLatin1String("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+
+    // e.g. "VmHWM:\t  123456 kB"
+    while (!status.atEnd()) {
+        const QByteArray line = status.readLine();
+        if (!line.startsWith("VmHWM:"))
+            continue;
+
+        const qlonglong kib = line.mid(6).simplified().split(' ').value(0).toLongLong();
+        qInfo("%s: peak RSS %lld MiB", QTest::currentDataTag(), kib / 1024);
+        return;
+    }
+}
+
+void BackendBenchmark::benchmarkInit_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkInit()
+{
+    QFETCH(int, packageCount);
+
+    // The first init builds pkgcache.bin and the metadata cache, so keep
+    // that out of the measurement
+    delete createBackend(packageCount);
+
+    QBENCHMARK {
+        Backend *backend = createBackend(packageCount);
+        QVERIFY(backend);
+        delete backend;
+    }
+
+    reportPeakRss();
+}
+
+void BackendBenchmark::benchmarkReloadCache_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkReloadCache()
+{
+    QFETCH(int, packageCount);
+
+    QScopedPointer<Backend> backend(createBackend(packageCount));
+    QVERIFY(backend);
+
+    QBENCHMARK {
+        QVERIFY(backend->reloadCache());
+    }
+
+    QCOMPARE(backend->packageCount(), packageCount);
+    reportPeakRss();
+}
+
+void BackendBenchmark::benchmarkSearch_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkSearch()
+{
+    QFETCH(int, packageCount);
+
+    QScopedPointer<Backend> backend(createBackend(packageCount));
+    QVERIFY(backend);
+
+    PackageList results;
+    QBENCHMARK {
+        results = backend->search(QLatin1String("synthetic package"));
+    }
+
+    QVERIFY(!results.isEmpty());
+    reportPeakRss();
+}
+
+void BackendBenchmark::benchmarkMarkPackages_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkMarkPackages()
+{
+    QFETCH(int, packageCount);
+
+    QScopedPointer<Backend> backend(createBackend(packageCount));
+    QVERIFY(backend);
+
+    // Mark one in a hundred of the packages that aren't installed yet
+    PackageList toInstall;
+    for (Package *pkg : backend->availablePackages()) {
+        if (!pkg->isInstalled() && pkg->id() % 100 == 1)
+            toInstall.append(pkg);
+    }
+
+    const CacheState cleanState = backend->currentCacheState();
+
+    QBENCHMARK {
+        backend->markPackages(toInstall, Package::ToInstall);
+        backend->restoreCacheState(cleanState);
+    }
+
+    reportPeakRss();
+}
+
+void BackendBenchmark::benchmarkStateChanges_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkStateChanges()
+{
+    QFETCH(int, packageCount);
+
+    QScopedPointer<Backend> backend(createBackend(packageCount));
+    QVERIFY(backend);
+
+    const CacheState cleanState = backend->currentCacheState();
+    backend->markPackagesForUpgrade();
+
+    QHash<Package::State, PackageList> changes;
+    QBENCHMARK {
+        changes = backend->stateChanges(cleanState, PackageList());
+    }
+
+    QVERIFY(!changes.value(Package::ToUpgrade).isEmpty());
+    reportPeakRss();
+}
+
+void BackendBenchmark::benchmarkLoadSelections_data()
+{
+    addSizeRows();
+}
+
+void BackendBenchmark::benchmarkLoadSelections()
+{
+    QFETCH(int, packageCount);
+
+    QScopedPointer<Backend> backend(createBackend(packageCount));
+    QVERIFY(backend);
+
+    // A fleet-style selections file: everything installed, one in a
+    // hundred of the other packages, and a package this machine lacks
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    for (Package *pkg : backend->availablePackages()) {
+        if (pkg->isInstalled() || pkg->id() % 100 == 1)
+            file.write(QByteArray(pkg->name().latin1()) + "\t\t\t\t\tinstall\n");
+    }
+    file.write("no-such-package\t\t\t\t\tinstall\n");
+    file.close();
+
+    const CacheState cleanState = backend->currentCacheState();
+    SelectionsReport report;
+
+    QBENCHMARK {
+        QVERIFY(backend->loadSelections(file.fileName(), &report));
+        backend->restoreCacheState(cleanState);
+    }
+
+    QCOMPARE(report.skipped.size(), 1);
+    QCOMPARE(report.skipped.first().reason, SelectionsReport::UnknownPackage);
+    reportPeakRss();
+}
+
+}
+
+QTEST_MAIN(QApt::BackendBenchmark);
+
+#include "backendbenchmark.moc"
@@ -0,0 +1,401 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include <apt-pkg/configuration.h>
+
+#include <atomic>
+#include <functional>
+
+#include <changelog.h>
+#include <dependencyinfo.h>
+#include <history.h>
+#include <sourceslist.h>
+
+#include <dpkgstatusreader.h>
+
+/*
+ * Throughput and allocation benchmarks for the library's text parsers.
+ *
+ * Besides the QBENCHMARK walltime, each benchmark does one extra pass to
+ * print its throughput in MB/s of input and the number of heap
+ * allocations made per parsed record. Allocations are counted by
+ * interposing the C allocator, which every Qt and libstdc++ allocation
+ * ends up in.
+ */
+
+namespace {
+
+std::atomic<quint64> s_allocations(0);
+
+}
+
+#ifdef __GLIBC__
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+}
+#endif
+
+namespace {
+
+void reportThroughput(qint64 bytes, int records, const std::function<void()> &parse)
+{
+    QElapsedTimer timer;
+    const quint64 allocationsBefore = s_allocations.load();
+    timer.start();
+
+    parse();
+
+    const qint64 nsecs = qMax<qint64>(timer.nsecsElapsed(), 1);
+    const quint64 allocations = s_allocations.load() - allocationsBefore;
+
+    qInfo("%s: %.1f MB/s, %.1f allocations per record (%d records, %.2f MB)",
+          QTest::currentTestFunction(),
+          (bytes / 1e6) / (nsecs / 1e9),
+          records ? double(allocations) / records : 0.0,
+          records, bytes / 1e6);
+}
+
+QByteArray sourcesFile(int file, int lines)
+{
+    QByteArray data;
+    data += "# Generated sources list " + QByteArray::number(file) + "\n\n";
+
+    for (int i = 0; i < lines; ++i) {
+        switch (i % 5) {
+        case 0:
+            data += "deb http://archive.example.org/ubuntu/ release" + QByteArray::number(i)
+                    + " main restricted universe multiverse\n";
+            break;
+        case 1:
+            data += "deb-src http://archive.example.org/ubuntu/ release" + QByteArray::number(i)
+                    + " main restricted\n";
+            break;
+        case 2:
+            data += "deb [arch=amd64,i386 trusted=yes] http://ppa.example.org/team/ppa/ubuntu release main"
+                    " # Added by software-properties\n";
+            break;
+        case 3:
+            data += "# deb http://archive.example.org/ubuntu/ release-proposed main restricted\n";
+            break;
+        case 4:
+            data += "deb cdrom:[Kubuntu 26.04 _Release_ amd64 (20260101)]/ release main\n";
+            break;
+        }
+    }
+
+    return data;
+}
+
+QString dependsField(int i)
+{
+    return QStringLiteral("libc6 (>= 2.34), libqt5core5a (>= 5.15.%1), libstdc++6 (>= 12), "
+                          "debconf (>= 0.5) | debconf-2.0, libfoo%1:any (<< %1.0~), "
+                          "python3:any, perl-base [amd64 i386], default-dbus-session-bus | dbus-session-bus, "
+                          "libapt-pkg6.0 (>= 2.7.%1), zlib1g (>= 1:1.2.0)").arg(i % 97);
+}
+
+QByteArray historyStanza(int i)
+{
+    QByteArray stanza;
+    const QByteArray day = QByteArray::number(1 + i % 28).rightJustified(2, '0');
+
+    stanza += "Start-Date: 2026-01-" + day + "  10:00:00\n";
+    stanza += "Commandline: apt-get dist-upgrade\n";
+    stanza += "Requested-By: user (1000)\n";
+
+    QByteArray upgrades;
+    QByteArray installs;
+    for (int pkg = 0; pkg < 40; ++pkg) {
+        if (pkg)
+            upgrades += ", ";
+        upgrades += "libpkg" + QByteArray::number(pkg) + ":amd64 (1." + QByteArray::number(i)
+                + "-1, 1." + QByteArray::number(i + 1) + "-1)";
+    }
+    for (int pkg = 0; pkg < 10; ++pkg) {
+        if (pkg)
+            installs += ", ";
+        installs += "newpkg" + QByteArray::number(i) + '-' + QByteArray::number(pkg)
+                + ":amd64 (2.0-1, automatic)";
+    }
+
+    stanza += "Install: " + installs + '\n';
+    stanza += "Upgrade: " + upgrades + '\n';
+    if (i % 10 == 0)
+        stanza += "Remove: oldpkg" + QByteArray::number(i) + ":amd64 (0.1-1)\n";
+    if (i % 50 == 0)
+        stanza += "Error: Sub-process /usr/bin/dpkg returned an error code (1)\n";
+    stanza += "End-Date: 2026-01-" + day + "  10:05:00\n\n";
+
+    return stanza;
+}
+
+QString changelogText(int entries)
+{
+    QString text;
+
+    for (int i = entries; i > 0; --i) {
+        text += QStringLiteral("benchpkg (1.%1-1) unstable; urgency=medium\n\n").arg(i);
+        text += QStringLiteral("  * New upstream release.\n");
+        text += QStringLiteral("  * Fix CVE-2026-%1: buffer overflow in the frobnicator.\n").arg(1000 + i);
+        text += QStringLiteral("    - Backport the upstream fix for the parser.\n");
+        text += QStringLiteral("  * debian/control: bump Standards-Version.\n\n");
+        text += QStringLiteral(" -- Jane Maintainer <jane@example.org>  Thu, 01 Jan 2026 12:00:00 +0000\n\n");
+    }
+
+    return text;
+}
+
+QByteArray dpkgStatus(int lines)
+{
+    QByteArray data;
+
+    for (int i = 0; i < lines; ++i) {
+        const QByteArray package = "libpkg" + QByteArray::number(i % 500) + ":amd64";
+        const QByteArray percent = QByteArray::number(100.0 * i / lines, 'f', 4);
+
+        switch (i % 4) {
+        case 0:
+            data += "pmstatus:" + package + ':' + percent + ":Preparing to unpack " + package + '\n';
+            break;
+        case 1:
+            data += "pmstatus:" + package + ':' + percent + ":Unpacking " + package
+                    + " (1:2." + QByteArray::number(i) + "-1)\n";
+            break;
+        case 2:
+            data += "pmstatus:" + package + ':' + percent + ":Setting up " + package
+                    + " (1:2." + QByteArray::number(i) + "-1)\n";
+            break;
+        case 3:
+            data += "pmstatus:dpkg-exec:" + percent + ":Running dpkg\n";
+            break;
+        }
+    }
+
+    return data;
+}
+
+}
+
+namespace QApt {
+
+class ParserBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void benchmarkSourcesList();
+    void benchmarkParseDepends();
+    void benchmarkHistory();
+    void benchmarkChangelog();
+    void benchmarkDpkgStatus();
+
+private:
+    QTemporaryDir m_dir;
+    QStringList m_sourceFiles;
+    qint64 m_sourcesBytes;
+    int m_sourcesLines;
+    qint64 m_historyBytes;
+    int m_historyStanzas;
+};
+
+void ParserBenchmark::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+
+    // A sources.list.d with a few hundred files
+    m_sourcesBytes = 0;
+    m_sourcesLines = 0;
+    QDir(m_dir.path()).mkpath(QLatin1String("sources.list.d"));
+    for (int i = 0; i < 300; ++i) {
+        const QString path = m_dir.path() + QStringLiteral("/sources.list.d/source%1.list").arg(i);
+        const QByteArray data = sourcesFile(i, 50);
+
+        QFile file(path);
+        QVERIFY(file.open(QFile::WriteOnly));
+        QCOMPARE(file.write(data), qint64(data.size()));
+
+        m_sourceFiles << path;
+        m_sourcesBytes += data.size();
+        m_sourcesLines += 50;
+    }
+
+    // Several megabytes of history log
+    m_historyBytes = 0;
+    m_historyStanzas = 20000;
+    QDir(m_dir.path()).mkpath(QLatin1String("log"));
+    QFile history(m_dir.path() + QLatin1String("/log/history.log"));
+    QVERIFY(history.open(QFile::WriteOnly));
+    for (int i = 0; i < m_historyStanzas; ++i) {
+        const QByteArray stanza = historyStanza(i);
+        history.write(stanza);
+        m_historyBytes += stanza.size();
+    }
+    history.close();
+
+    _config->Set("Dir::Log::History", QFile::encodeName(history.fileName()).constData());
+}
+
+void ParserBenchmark::benchmarkSourcesList()
+{
+    SourceEntryList entries;
+
+    QBENCHMARK {
+        SourcesList list(nullptr, m_sourceFiles);
+        entries = list.entries();
+    }
+
+    QVERIFY(!entries.isEmpty());
+
+    reportThroughput(m_sourcesBytes, m_sourcesLines, [this]() {
+        SourcesList list(nullptr, m_sourceFiles);
+        list.entries();
+    });
+}
+
+void ParserBenchmark::benchmarkParseDepends()
+{
+    const int fieldCount = 20000;
+    QStringList fields;
+    qint64 bytes = 0;
+    for (int i = 0; i < fieldCount; ++i) {
+        fields << dependsField(i);
+        bytes += fields.last().toUtf8().size();
+    }
+
+    int groups = 0;
+    QBENCHMARK {
+        groups = 0;
+        for (const QString &field : fields)
+            groups += DependencyInfo::parseDepends(field, Depends).size();
+    }
+
+    QVERIFY(groups > 0);
+
+    reportThroughput(bytes, fieldCount, [&fields]() {
+        for (const QString &field : fields)
+            DependencyInfo::parseDepends(field, Depends);
+    });
+}
+
+void ParserBenchmark::benchmarkHistory()
+{
+    int items = 0;
+
+    QBENCHMARK {
+        History history(nullptr);
+        items = history.historyItems().size();
+    }
+
+    QCOMPARE(items, m_historyStanzas);
+
+    reportThroughput(m_historyBytes, m_historyStanzas, []() {
+        History history(nullptr);
+    });
+}
+
+void ParserBenchmark::benchmarkChangelog()
+{
+    const int entryCount = 5000;
+    const QString text = changelogText(entryCount);
+
+    ChangelogEntryList entries;
+    QBENCHMARK {
+        Changelog changelog(text, QLatin1String("benchpkg"));
+        entries = changelog.entries();
+    }
+
+    QCOMPARE(entries.size(), entryCount);
+
+    reportThroughput(text.toUtf8().size(), entryCount, [&text]() {
+        Changelog changelog(text, QLatin1String("benchpkg"));
+        changelog.entries();
+    });
+}
+
+void ParserBenchmark::benchmarkDpkgStatus()
+{
+    const int lineCount = 50000;
+    const QByteArray data = dpkgStatus(lineCount);
+
+    // Fed in pipe-sized chunks, so lines are split across reads
+    auto parse = [&data]() {
+        DpkgStatusReader reader;
+        int lines = 0;
+        int percentage = 0;
+        const int chunkSize = 4096;
+
+        for (int i = 0; i < data.size(); i += chunkSize) {
+            reader.append(data.constData() + i, qMin(chunkSize, data.size() - i));
+            reader.takeLines([&](const DpkgStatusLine &line) {
+                percentage = line.percentage();
+                ++lines;
+            });
+        }
+
+        Q_UNUSED(percentage);
+        return lines;
+    };
+
+    int lines = 0;
+    QBENCHMARK {
+        lines = parse();
+    }
+
+    QCOMPARE(lines, lineCount);
+
+    reportThroughput(data.size(), lineCount, [&parse]() {
+        parse();
+    });
+}
+
+}
+
+QTEST_MAIN(QApt::ParserBenchmark);
+
+#include "parserbenchmark.moc"
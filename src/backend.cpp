@@ -22,8 +22,14 @@
 
 // Qt includes
 #include <QByteArray>
+#include <QMutex>
+#include <QSaveFile>
 #include <QTemporaryFile>
+#include <QThread>
+#include <QTimer>
 #include <QDBusConnection>
+#include <QDBusMetaType>
+#include <QMetaMethod>
 
 // Apt includes
 #include <apt-pkg/acquire.h>
@@ -34,9 +40,11 @@
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/gpgv.h>
 #include <apt-pkg/init.h>
+#include <apt-pkg/mmap.h>
 #include <apt-pkg/pkgrecords.h>
 #include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/policy.h>
+#include <apt-pkg/progress.h>
 #include <apt-pkg/sourcelist.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/tagfile.h>
@@ -46,15 +54,39 @@
 #undef slots
 #include <xapian.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
 // QApt includes
 #include "cache.h"
 #include "config.h" // krazy:exclude=includes
 #include "dbusinterfaces_p.h"
 #include "debfile.h"
+#include "downloadprogressbatch.h"
+#include "metadatacache.h"
+#include "tracer.h"
 #include "transaction.h"
 
 namespace QApt {
 
+// The marking state of a package in the live cache, taken so that it can be
+// replayed onto a scratch cache, possibly in another thread
+struct LiveMark {
+    enum Flag {
+        Auto = 1 << 0,
+        Install = 1 << 1,
+        Delete = 1 << 2,
+        Purge = 1 << 3,
+        ReInstall = 1 << 4
+    };
+
+    pkgCache::Version *candidate;
+    int flags;
+};
+
+class UpgradeComputation;
+
 class BackendPrivate
 {
 public:
@@ -67,6 +99,10 @@ public:
         , config(nullptr)
         , actionGroup(nullptr)
         , frontendCaps(QApt::NoCaps)
+        , touchedAll(false)
+        , upgradeComputation(nullptr)
+        , pendingMetadataPosition(0)
+        , metadataTimer(nullptr)
     {
     }
     ~BackendPrivate()
@@ -89,6 +125,15 @@ public:
     QHash<QString, QString> originMap;
     // Relation of an origin and its hostname
     QHash<QString, QString> siteMap;
+    // Sidecar file holding the above, shared across processes
+    MetadataCache metadataCache;
+    // Tables for the sidecar, filled in by fillMetadataCache() after a
+    // reload that could not use it
+    MetadataCache::Data pendingMetadata;
+    QString pendingMetadataPath;
+    QByteArray pendingMetadataKey;
+    int pendingMetadataPosition;
+    QTimer *metadataTimer;
 
     // Date when the distribution's release was issued. See Backend::releaseDate()
     QDateTime releaseDate;
@@ -126,11 +171,326 @@ public:
 
     // Other
     bool writeSelectionFile(const QString &file, const QString &path) const;
+    bool writeSelections(const QString &path,
+                         const std::function<const char *(const pkgCache::PkgIterator &)> &selection) const;
+    Transaction *createTransaction(QDBusPendingReply<QString> reply, const char *call) const;
     QString customProxy;
     QString initErrorMessage;
     QApt::FrontendCaps frontendCaps;
+
+    // Package states as of the last packagesChanged(), indexed like packages
+    struct TrackedState {
+        pkgCache::Version *candidate;
+        int state;
+    };
+    QVector<TrackedState> trackedStates;
+    // Indexes of the packages that were marked as of the last
+    // packagesChanged(), and of those changed since other than by marking
+    QVector<int> markedIndexes;
+    QVector<int> touchedIndexes;
+    bool touchedAll;
+    int packageIndex(int id) const;
+
+    // Scratch caches
+    QVector<LiveMark> liveMarks() const;
+    static void replayMarks(pkgDepCache &scratch, const QVector<LiveMark> &marks);
+    // Mutable, as even const methods have to cancel it to use the resolver
+    mutable UpgradeComputation *upgradeComputation;
+    // Cancelled computations that are still winding down
+    mutable QList<UpgradeComputation *> abandonedComputations;
+    void cancelUpgradeComputation() const;
+    // For when the package cache is about to go away
+    void waitForUpgradeComputations() const;
+
+    // Marking, shared by the live and scratch caches
+    static bool applyMark(pkgDepCache &deps, pkgProblemResolver &fix, const Package *package,
+                          Package::State action, bool &needsResolve);
+    static void resolveMarks(pkgDepCache &deps, pkgProblemResolver &fix,
+                             Package::State action, bool needsResolve);
+    static bool isMarked(pkgDepCache &deps, const Package *package, Package::State action);
 };
 
+int BackendPrivate::packageIndex(int id) const
+{
+    return metadataCache.isOpen() ? metadataCache.packageIndex(id) : packagesIndex.value(id, -1);
+}
+
+QVector<LiveMark> BackendPrivate::liveMarks() const
+{
+    pkgDepCache *liveCache = cache->depCache();
+    QVector<LiveMark> marks(liveCache->Head().PackageCount);
+
+    for (pkgCache::PkgIterator iter = liveCache->PkgBegin(); !iter.end(); ++iter) {
+        const pkgDepCache::StateCache &state = (*liveCache)[iter];
+        LiveMark &mark = marks[iter->ID];
+
+        mark.candidate = state.CandidateVer;
+        mark.flags = 0;
+
+        if (state.Flags & pkgCache::Flag::Auto)
+            mark.flags |= LiveMark::Auto;
+        if (state.Install())
+            mark.flags |= LiveMark::Install;
+        else if (state.Delete())
+            mark.flags |= LiveMark::Delete;
+        if (state.iFlags & pkgDepCache::Purge)
+            mark.flags |= LiveMark::Purge;
+        if (state.iFlags & pkgDepCache::ReInstall)
+            mark.flags |= LiveMark::ReInstall;
+    }
+
+    return marks;
+}
+
+void BackendPrivate::replayMarks(pkgDepCache &scratch, const QVector<LiveMark> &marks)
+{
+    pkgCache &cache = scratch.GetCache();
+    pkgDepCache::ActionGroup group(scratch);
+
+    for (pkgCache::PkgIterator iter = scratch.PkgBegin(); !iter.end(); ++iter) {
+        const LiveMark &mark = marks.at(iter->ID);
+        const pkgDepCache::StateCache &state = scratch[iter];
+
+        if (mark.candidate != state.CandidateVer && mark.candidate)
+            scratch.SetCandidateVersion(pkgCache::VerIterator(cache, mark.candidate));
+
+        const bool isAuto = mark.flags & LiveMark::Auto;
+        if (isAuto != bool(state.Flags & pkgCache::Flag::Auto))
+            scratch.MarkAuto(iter, isAuto);
+
+        if (mark.flags & LiveMark::Install) {
+            scratch.MarkInstall(iter, false, 0, !isAuto);
+        } else if (mark.flags & LiveMark::Delete) {
+            scratch.MarkDelete(iter, mark.flags & LiveMark::Purge);
+        }
+
+        if (mark.flags & LiveMark::ReInstall)
+            scratch.SetReInstall(iter, true);
+    }
+}
+
+bool BackendPrivate::applyMark(pkgDepCache &deps, pkgProblemResolver &fix, const Package *package,
+                               Package::State action, bool &needsResolve)
+{
+    const pkgCache::PkgIterator &iter = package->packageIterator();
+    int state = package->staticState();
+
+    switch (action) {
+    case Package::ToInstall:
+        // Mark for install if not already installed, or if upgradeable
+        if ((state & Package::Installed) && !(state & Package::Upgradeable))
+            return false;
+
+        deps.MarkInstall(iter, true);
+        fix.Clear(iter);
+        fix.Protect(iter);
+
+        // Let the resolver have a go at what MarkInstall couldn't satisfy
+        if (!deps[iter].Install())
+            needsResolve = true;
+        return true;
+    case Package::ToRemove:
+    case Package::ToPurge: {
+        const bool purge = (action == Package::ToPurge);
+        if (!(state & Package::Installed) && !(purge && (state & Package::ResidualConfig)))
+            return false;
+
+        fix.Clear(iter);
+        fix.Protect(iter);
+        fix.Remove(iter);
+        deps.SetReInstall(iter, false);
+        deps.MarkDelete(iter, purge);
+        needsResolve = true;
+        return true;
+    }
+    case Package::ToUpgrade: {
+        bool fromUser = !(deps[iter].Flags & pkgCache::Flag::Auto);
+        deps.MarkInstall(iter, true, 0, fromUser);
+        return true;
+    }
+    case Package::ToReInstall:
+        if (!(state & Package::Installed)
+            || (state & Package::NotDownloadable)
+            || (state & Package::Upgradeable))
+            return false;
+
+        deps.SetReInstall(iter, true);
+        return true;
+    case Package::ToKeep:
+        deps.MarkKeep(iter, false);
+        if (deps[iter].iFlags & pkgDepCache::ReInstall) {
+            deps.SetReInstall(iter, false);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+void BackendPrivate::resolveMarks(pkgDepCache &deps, pkgProblemResolver &fix,
+                                  Package::State action, bool needsResolve)
+{
+    if (deps.BrokenCount() > 0) {
+        if (action == Package::ToKeep) {
+            QAPT_TRACE_SPAN("pkgProblemResolver::ResolveByKeep");
+            QMutexLocker locker(Cache::resolverMutex());
+            fix.ResolveByKeep();
+        } else {
+            needsResolve = true;
+        }
+    }
+
+    if (needsResolve && (action == Package::ToInstall || action == Package::ToRemove ||
+                         action == Package::ToPurge)) {
+        QAPT_TRACE_SPAN("pkgProblemResolver::Resolve");
+        QMutexLocker locker(Cache::resolverMutex());
+        fix.Resolve(true);
+    }
+}
+
+bool BackendPrivate::isMarked(pkgDepCache &deps, const Package *package, Package::State action)
+{
+    const pkgDepCache::StateCache &stateCache = deps[package->packageIterator()];
+
+    switch (action) {
+    case Package::ToInstall:
+    case Package::ToUpgrade:
+        return stateCache.Install() && !stateCache.InstBroken();
+    case Package::ToRemove:
+    case Package::ToPurge:
+        return stateCache.Delete();
+    case Package::ToReInstall:
+        return stateCache.iFlags & pkgDepCache::ReInstall;
+    case Package::ToKeep:
+        return stateCache.Keep();
+    default:
+        return true;
+    }
+}
+
+/**
+ * Works out an upgrade on a scratch set of package states over the
+ * Backend's package cache, so that it can run outside of the GUI thread.
+ */
+class UpgradeComputation : public QThread
+{
+public:
+    UpgradeComputation(Backend *backend, Cache *cache, const QVector<LiveMark> &marks, int mode)
+        : QThread(backend)
+        , m_backend(backend)
+        , m_scratch(&cache->depCache()->GetCache(), cache->policy())
+        , m_marks(marks)
+        , m_mode(mode)
+        , m_cancelled(false)
+        , m_succeeded(false)
+    {
+    }
+
+    Backend *backend() const { return m_backend; }
+    pkgDepCache *scratch() { return &m_scratch; }
+    bool succeeded() const { return m_succeeded; }
+
+    void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+protected:
+    void run() override;
+
+private:
+    Backend *m_backend;
+    pkgDepCache m_scratch;
+    QVector<LiveMark> m_marks;
+    int m_mode;
+    std::atomic<bool> m_cancelled;
+    bool m_succeeded;
+};
+
+/**
+ * Forwards the progress of one step of an UpgradeComputation, scaled into
+ * its share of the overall percentage. Cancelled computations go quiet.
+ */
+class UpgradeProgress : public OpProgress
+{
+public:
+    UpgradeProgress(UpgradeComputation *computation, int start, int span)
+        : m_computation(computation)
+        , m_start(start)
+        , m_span(span)
+        , m_lastPercentage(-1)
+    {
+    }
+
+protected:
+    void Update() override
+    {
+        if (m_computation->isCancelled())
+            return;
+
+        const int percentage = m_start + qRound(Percent * m_span / 100);
+        if (percentage == m_lastPercentage)
+            return;
+
+        m_lastPercentage = percentage;
+        // Queued over to the receivers' threads
+        emit m_computation->backend()->upgradeComputationProgress(percentage);
+    }
+
+private:
+    UpgradeComputation *m_computation;
+    int m_start;
+    int m_span;
+    int m_lastPercentage;
+};
+
+void UpgradeComputation::run()
+{
+    QAPT_TRACE_SPAN("UpgradeComputation::run");
+
+    // APT can't be interrupted part way through a step, so cancellation is
+    // checked for in between them
+    UpgradeProgress initProgress(this, 0, 20);
+    if (m_scratch.Init(&initProgress) && !isCancelled()) {
+        BackendPrivate::replayMarks(m_scratch, m_marks);
+
+        if (!isCancelled()) {
+            UpgradeProgress upgradeProgress(this, 20, 80);
+            QMutexLocker locker(Cache::resolverMutex());
+
+            // It may have been cancelled while waiting for the resolver
+            if (!isCancelled())
+                m_succeeded = APT::Upgrade::Upgrade(m_scratch, m_mode, &upgradeProgress);
+        }
+    }
+
+    // Errors only mean the computation failed, which is reported as such
+    _error->Discard();
+}
+
+void BackendPrivate::cancelUpgradeComputation() const
+{
+    if (!upgradeComputation)
+        return;
+
+    // Left to wind down in the background, and deleted once it has. A
+    // resolve that is already under way holds on to the resolver until it
+    // is done, but nothing waits on the rest.
+    upgradeComputation->cancel();
+    abandonedComputations.append(upgradeComputation);
+
+    // Queued, since this is called in the middle of marking
+    QMetaObject::invokeMethod(upgradeComputation->backend(), "upgradeComputationCancelled",
+                              Qt::QueuedConnection);
+    upgradeComputation = nullptr;
+}
+
+void BackendPrivate::waitForUpgradeComputations() const
+{
+    cancelUpgradeComputation();
+
+    for (UpgradeComputation *computation : abandonedComputations)
+        computation->wait();
+}
+
 QDateTime BackendPrivate::getReleaseDateFromDistroInfo(const QString &releaseId, const QString &releaseCodename) const
 {
     QDateTime releaseDate;
@@ -206,6 +566,113 @@ bool BackendPrivate::writeSelectionFile(const QString &selectionDocument, const
     return true;
 }
 
+bool BackendPrivate::writeSelections(const QString &path,
+                                     const std::function<const char *(const pkgCache::PkgIterator &)> &selection) const
+{
+    QSaveFile file(path);
+    file.setDirectWriteFallback(true);
+    if (!file.open(QFile::WriteOnly)) {
+        return false;
+    }
+
+    // One line at a time through QFile's buffer, reusing the line's storage
+    QByteArray line;
+    int count = 0;
+
+    for (const Package *pkg : packages) {
+        const pkgCache::PkgIterator &iter = pkg->packageIterator();
+        const char *state = selection(iter);
+        if (!state)
+            continue;
+
+        // Like dpkg --get-selections, only foreign packages get an arch suffix
+        const std::string name = iter.FullName(true);
+
+        line.resize(0);
+        line.append(name.data(), int(name.size()));
+        line.append("\t\t");
+        line.append(state);
+        line.append('\n');
+
+        file.write(line);
+        ++count;
+    }
+
+    if (!count) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+namespace {
+
+// Typical bookkeeping overhead of a glibc heap allocation
+const qint64 s_mallocOverhead = 16;
+
+qint64 stringSize(const QString &string)
+{
+    // Implicitly shared strings get counted once per copy
+    if (string.isEmpty())
+        return 0;
+
+    return sizeof(QArrayData) + (string.capacity() + 1) * sizeof(QChar) + s_mallocOverhead;
+}
+
+qint64 stringHashSize(const QHash<QString, QString> &hash)
+{
+    // Bucket array, plus a node (next, hash, key, value) per item
+    const qint64 nodeSize = 2 * sizeof(void *) + 2 * sizeof(QString) + s_mallocOverhead;
+    qint64 size = hash.capacity() * sizeof(void *) + hash.size() * nodeSize;
+
+    for (auto it = hash.cbegin(); it != hash.cend(); ++it) {
+        size += stringSize(it.key()) + stringSize(it.value());
+    }
+
+    return size;
+}
+
+qint64 stringSetSize(const QSet<QString> &set)
+{
+    const qint64 nodeSize = 2 * sizeof(void *) + sizeof(QString) + s_mallocOverhead;
+    qint64 size = set.capacity() * sizeof(void *) + set.size() * nodeSize;
+
+    for (const QString &string : set) {
+        size += stringSize(string);
+    }
+
+    return size;
+}
+
+qint64 cacheStateStackSize(const QList<CacheState> &stack)
+{
+    // QList stores ints in pointer-sized slots
+    qint64 size = sizeof(QListData::Data) + stack.size() * sizeof(void *);
+
+    for (const CacheState &state : stack) {
+        size += sizeof(QListData::Data) + state.size() * sizeof(void *) + s_mallocOverhead;
+    }
+
+    return size;
+}
+
+}
+
+Transaction *BackendPrivate::createTransaction(QDBusPendingReply<QString> reply, const char *call) const
+{
+    {
+        // The call itself is asynchronous, waiting on the reply is what costs
+        TraceSpan span(call);
+        reply.waitForFinished();
+    }
+
+    Transaction *trans = new Transaction(reply.value());
+    trans->setFrontendCaps(frontendCaps);
+
+    return trans;
+}
+
 Backend::Backend(QObject *parent)
         : QObject(parent)
         , d_ptr(new BackendPrivate)
@@ -218,10 +685,25 @@ Backend::Backend(QObject *parent)
     connect(d->worker, SIGNAL(transactionQueueChanged(QString,QStringList)),
             this, SIGNAL(transactionQueueChanged(QString,QStringList)));
     DownloadProgress::registerMetaTypes();
+    qRegisterMetaType<QApt::PropertyMap>("QApt::PropertyMap");
+    qDBusRegisterMetaType<QApt::PropertyMap>();
+    qDBusRegisterMetaType<QApt::DownloadProgressRecord>();
+    qDBusRegisterMetaType<QApt::DownloadProgressBatch>();
+
+    d->metadataTimer = new QTimer(this);
+    connect(d->metadataTimer, &QTimer::timeout, this, &Backend::fillMetadataCache);
+
+    if (qEnvironmentVariableIsSet("QAPT_TRACE_FILE"))
+        Tracer::setEnabled(true);
 }
 
 Backend::~Backend()
 {
+    d_ptr->waitForUpgradeComputations();
+
+    if (qEnvironmentVariableIsSet("QAPT_TRACE_FILE"))
+        Tracer::save(QFile::decodeName(qgetenv("QAPT_TRACE_FILE")));
+
     delete d_ptr;
 }
 
@@ -246,17 +728,32 @@ bool Backend::reloadCache()
 {
     Q_D(Backend);
 
+    QAPT_TRACE_SPAN("Backend::reloadCache");
+
+    // Running computations use the package cache that is about to go away
+    d->waitForUpgradeComputations();
+
+    // The pending tables point at packages that are about to go away
+    d->metadataTimer->stop();
+    d->pendingMetadata = MetadataCache::Data();
+
     emit cacheReloadStarted();
 
-    if (!d->cache->open()) {
-        setInitError();
-        return false;
+    {
+        QAPT_TRACE_SPAN("Cache::open");
+        if (!d->cache->open()) {
+            setInitError();
+            return false;
+        }
     }
 
     pkgDepCache *depCache = d->cache->depCache();
 
     delete d->records;
-    d->records = new pkgRecords(*depCache);
+    {
+        QAPT_TRACE_SPAN("pkgRecords");
+        d->records = new pkgRecords(*depCache);
+    }
 
     qDeleteAll(d->packages);
     d->packages.clear();
@@ -267,45 +764,94 @@ bool Backend::reloadCache()
     d->installedCount = 0;
 
     int packageCount = depCache->Head().PackageCount;
+    d->packages.reserve(packageCount);
+
+    d->isMultiArch = architectures().size() > 1;
+
+    const QString metadataPath = MetadataCache::path(d->config);
+    const QByteArray metadataKey = metadataPath.isEmpty() ? QByteArray()
+                                                          : MetadataCache::computeKey(d->config);
+
+    if (d->metadataCache.open(metadataPath, metadataKey, depCache)) {
+        QAPT_TRACE_SPAN("Backend::reloadCache packages (cached)");
+
+        // Nothing the derived tables depend on has changed since they were
+        // last computed, so skip straight to creating the package objects
+        pkgCache::PkgIterator iter;
+        for (iter = depCache->PkgBegin(); !iter.end(); ++iter) {
+            if (!iter->VersionList) {
+                continue; // Exclude virtual packages.
+            }
+
+            Package *pkg = new Package(this, iter);
+            pkg->setStaticState(d->metadataCache.staticState(iter->ID));
+            d->packages.append(pkg);
+        }
+
+        d->installedCount = d->metadataCache.installedCount();
+        d->groups = d->metadataCache.groups();
+        d->originMap = d->metadataCache.originMap();
+        d->siteMap = d->metadataCache.siteMap();
+        d->releaseDate = d->metadataCache.releaseDate();
+
+        for (quint32 id : d->metadataCache.pinnedIds()) {
+            int index = d->metadataCache.packageIndex(id);
+            if (index >= 0 && index < d->packages.size())
+                d->packages.at(index)->setPinned(true);
+        }
+
+        d->undoStack.clear();
+        d->redoStack.clear();
+
+        resetChangeTracking();
+
+        QAPT_TRACE_COUNTER("packages", d->packages.size());
+
+        emit cacheReloadFinished();
+
+        return true;
+    }
+
     d->packagesIndex.resize(packageCount);
     d->packagesIndex.fill(-1);
-    d->packages.reserve(packageCount);
 
     // Populate internal package cache
     int count = 0;
 
-    d->isMultiArch = architectures().size() > 1;
+    {
+        QAPT_TRACE_SPAN("Backend::reloadCache packages");
 
-    pkgCache::PkgIterator iter;
-    for (iter = depCache->PkgBegin(); !iter.end(); ++iter) {
-        if (!iter->VersionList) {
-            continue; // Exclude virtual packages.
-        }
+        pkgCache::PkgIterator iter;
+        for (iter = depCache->PkgBegin(); !iter.end(); ++iter) {
+            if (!iter->VersionList) {
+                continue; // Exclude virtual packages.
+            }
 
-        Package *pkg = new Package(this, iter);
+            Package *pkg = new Package(this, iter);
 
-        d->packagesIndex[iter->ID] = count;
-        d->packages.append(pkg);
-        ++count;
+            d->packagesIndex[iter->ID] = count;
+            d->packages.append(pkg);
+            ++count;
 
-        if (iter->CurrentVer) {
-            d->installedCount++;
-        }
+            if (iter->CurrentVer) {
+                d->installedCount++;
+            }
 
-        QString group = pkg->section();
+            QString group = pkg->section();
 
-        // Populate groups
-        if (!group.isEmpty()) {
-            d->groups << group;
-        }
+            // Populate groups
+            if (!group.isEmpty()) {
+                d->groups << group;
+            }
 
-        pkgCache::VerIterator Ver = (*depCache)[iter].CandidateVerIter(*depCache);
+            pkgCache::VerIterator Ver = (*depCache)[iter].CandidateVerIter(*depCache);
 
-        if(!Ver.end()) {
-            const pkgCache::VerFileIterator VF = Ver.FileList();
-            const QString origin(QLatin1String(VF.File().Origin()));
-            d->originMap[origin] = QLatin1String(VF.File().Label());
-            d->siteMap[origin] = QLatin1String(VF.File().Site());
+            if(!Ver.end()) {
+                const pkgCache::VerFileIterator VF = Ver.FileList();
+                const QString origin(QLatin1String(VF.File().Origin()));
+                d->originMap[origin] = QLatin1String(VF.File().Label());
+                d->siteMap[origin] = QLatin1String(VF.File().Site());
+            }
         }
     }
 
@@ -315,15 +861,84 @@ bool Backend::reloadCache()
     d->redoStack.clear();
 
     // Determine which packages are pinned for display purposes
-    loadPackagePins();
+    {
+        QAPT_TRACE_SPAN("Backend::loadPackagePins");
+        loadPackagePins();
+    }
 
-    loadReleaseDate();
+    {
+        QAPT_TRACE_SPAN("Backend::loadReleaseDate");
+        loadReleaseDate();
+    }
+
+    if (!metadataPath.isEmpty()) {
+        // Computing the static state of every package takes longer than
+        // the reload itself, so leave it for when the event loop is idle
+        MetadataCache::Data &data = d->pendingMetadata;
+        data.packagesIndex = d->packagesIndex;
+        data.staticStates.resize(packageCount);
+        data.staticStates.fill(0);
+        data.groups = d->groups;
+        data.originMap = d->originMap;
+        data.siteMap = d->siteMap;
+        data.releaseDate = d->releaseDate;
+        data.installedCount = d->installedCount;
+
+        d->pendingMetadataPath = metadataPath;
+        d->pendingMetadataKey = metadataKey;
+        d->pendingMetadataPosition = 0;
+        d->metadataTimer->start(0);
+    }
+
+    resetChangeTracking();
+
+    QAPT_TRACE_COUNTER("packages", d->packages.size());
 
     emit cacheReloadFinished();
 
     return true;
 }
 
+void Backend::fillMetadataCache()
+{
+    Q_D(Backend);
+
+    QAPT_TRACE_SPAN("Backend::fillMetadataCache");
+
+    // Pins and holds are reapplied separately, version overrides are
+    // never carried across a reload. The depcache flags depend on
+    // configuration the key does not cover, see Package::setStaticState()
+    const int mutableFlags = Package::IsPinned | Package::IsManuallyHeld |
+                             Package::OverrideVersion | Package::NowBroken |
+                             Package::InstallBroken | Package::IsGarbage |
+                             Package::NowPolicyBroken | Package::InstallPolicyBroken;
+
+    // Small steps, so that the event loop stays responsive
+    MetadataCache::Data &data = d->pendingMetadata;
+    const int end = qMin(d->pendingMetadataPosition + 1000, d->packages.size());
+    for (int i = d->pendingMetadataPosition; i < end; ++i) {
+        const Package *pkg = d->packages.at(i);
+        const int state = pkg->staticState();
+        data.staticStates[pkg->id()] = state & ~mutableFlags;
+        if (state & Package::IsPinned)
+            data.pinnedIds.append(pkg->id());
+    }
+    d->pendingMetadataPosition = end;
+
+    if (end < d->packages.size())
+        return;
+
+    d->metadataTimer->stop();
+
+    {
+        QAPT_TRACE_SPAN("MetadataCache::write");
+        MetadataCache::write(d->pendingMetadataPath, d->pendingMetadataKey,
+                             d->cache->depCache(), data);
+    }
+
+    d->pendingMetadata = MetadataCache::Data();
+}
+
 void Backend::setInitError()
 {
     Q_D(Backend);
@@ -439,8 +1054,8 @@ Package *Backend::package(pkgCache::PkgIterator &iter) const
 {
     Q_D(const Backend);
 
-    int index = d->packagesIndex.at(iter->ID);
-    if (index != -1 && index < d->packages.size()) {
+    int index = d->packageIndex(iter->ID);
+    if (index >= 0 && index < d->packages.size()) {
         return d->packages.at(index);
     }
 
@@ -639,6 +1254,8 @@ PackageList Backend::search(const QString &searchString) const
         return QApt::PackageList();
     }
 
+    QAPT_TRACE_SPAN("Backend::search");
+
     std::string unsplitSearchString = searchString.toStdString();
     static int qualityCutoff = 15;
     PackageList searchResult;
@@ -811,7 +1428,11 @@ bool Backend::openXapianIndex()
 {
     Q_D(Backend);
 
-    QFileInfo timeStamp(QLatin1String("/var/lib/apt-xapian-index/update-timestamp"));
+    // Overridable so that search can be exercised against a private index
+    const QString indexDir = d->config->findDirectory(QLatin1String("QApt::Xapian::IndexDir"),
+                                                      QLatin1String("/var/lib/apt-xapian-index/"));
+
+    QFileInfo timeStamp(indexDir % QLatin1String("update-timestamp"));
     d->xapianTimeStamp = timeStamp.lastModified().toTime_t();
 
     if(d->xapianDatabase) {
@@ -819,7 +1440,8 @@ bool Backend::openXapianIndex()
         d->xapianDatabase = 0;
     }
     try {
-        d->xapianDatabase = new Xapian::Database("/var/lib/apt-xapian-index/index");
+        QAPT_TRACE_SPAN("Xapian::Database");
+        d->xapianDatabase = new Xapian::Database(QFile::encodeName(indexDir % QLatin1String("index")).toStdString());
         d->xapianIndexExists = true;
     } catch (Xapian::DatabaseOpeningError) {
         d->xapianIndexExists = false;
@@ -943,6 +1565,9 @@ void Backend::restoreCacheState(const CacheState &state)
         if (oldflags == flags)
             continue;
 
+        // Only the auto flag might have changed
+        touchChangeTracking(pkg);
+
         if ((flags & Package::ToReInstall) && !(oldflags & Package::ToReInstall)) {
             deps->SetReInstall(pkg->packageIterator(), false);
         }
@@ -961,7 +1586,7 @@ void Backend::restoreCacheState(const CacheState &state)
         deps->MarkAuto(pkg->packageIterator(), (oldflags & Package::IsAuto));
     }
 
-    emit packageChanged();
+    emitPackageChanged();
 }
 
 void Backend::setUndoRedoCacheSize(int newSize)
@@ -1026,16 +1651,91 @@ void Backend::markPackagesForUpgrade()
 {
     Q_D(Backend);
 
-    APT::Upgrade::Upgrade(*d->cache->depCache(), APT::Upgrade::FORBID_REMOVE_PACKAGES | APT::Upgrade::FORBID_INSTALL_NEW_PACKAGES);
-    emit packageChanged();
+    d->cancelUpgradeComputation();
+
+    {
+        QAPT_TRACE_SPAN("APT::Upgrade::Upgrade");
+        QMutexLocker locker(Cache::resolverMutex());
+        APT::Upgrade::Upgrade(*d->cache->depCache(), APT::Upgrade::FORBID_REMOVE_PACKAGES | APT::Upgrade::FORBID_INSTALL_NEW_PACKAGES);
+    }
+
+    // Unlocked, since receivers may well mark packages in turn
+    emitPackageChanged();
 }
 
 void Backend::markPackagesForDistUpgrade()
 {
     Q_D(Backend);
 
-    APT::Upgrade::Upgrade(*d->cache->depCache(), APT::Upgrade::ALLOW_EVERYTHING);
-    emit packageChanged();
+    d->cancelUpgradeComputation();
+
+    {
+        QAPT_TRACE_SPAN("APT::Upgrade::Upgrade");
+        QMutexLocker locker(Cache::resolverMutex());
+        APT::Upgrade::Upgrade(*d->cache->depCache(), APT::Upgrade::ALLOW_EVERYTHING);
+    }
+
+    // Unlocked, since receivers may well mark packages in turn
+    emitPackageChanged();
+}
+
+void Backend::computeUpgrade(UpgradeType upgradeType)
+{
+    Q_D(Backend);
+
+    cancelUpgradeComputation();
+
+    int mode;
+    switch (upgradeType) {
+    case SafeUpgrade:
+        mode = APT::Upgrade::FORBID_REMOVE_PACKAGES | APT::Upgrade::FORBID_INSTALL_NEW_PACKAGES;
+        break;
+    case FullUpgrade:
+        mode = APT::Upgrade::ALLOW_EVERYTHING;
+        break;
+    default:
+        emit upgradeComputed(CacheState());
+        return;
+    }
+
+    d->upgradeComputation = new UpgradeComputation(this, d->cache, d->liveMarks(), mode);
+    connect(d->upgradeComputation, SIGNAL(finished()),
+            this, SLOT(upgradeComputationFinished()));
+    d->upgradeComputation->start(QThread::LowPriority);
+}
+
+void Backend::cancelUpgradeComputation()
+{
+    Q_D(Backend);
+
+    d->cancelUpgradeComputation();
+}
+
+void Backend::upgradeComputationFinished()
+{
+    Q_D(Backend);
+
+    UpgradeComputation *computation = static_cast<UpgradeComputation *>(sender());
+    computation->deleteLater();
+
+    // Cancelled ones have already said so
+    if (computation != d->upgradeComputation) {
+        d->abandonedComputations.removeAll(computation);
+        return;
+    }
+
+    d->upgradeComputation = nullptr;
+
+    CacheState state;
+    if (computation->succeeded()) {
+        state.reserve(d->packages.size());
+        for (Package *pkg : d->packages) {
+            state.append(Package::dynamicState(computation->scratch(), pkg->packageIterator())
+                         | pkg->staticState());
+        }
+    }
+
+    emit upgradeComputed(state);
 }
 
 void Backend::markPackagesForAutoRemove()
@@ -1056,7 +1756,7 @@ void Backend::markPackagesForAutoRemove()
             cache.MarkDelete(pkgIter, false);
     }
 
-    emit packageChanged();
+    emitPackageChanged();
 }
 
 void Backend::markPackageForInstall(const QString &name)
@@ -1072,65 +1772,126 @@ void Backend::markPackageForRemoval(const QString &name)
 }
 
 void Backend::markPackages(const QApt::PackageList &packages, QApt::Package::State action)
+{
+    if (packages.isEmpty()) {
+        return;
+    }
+
+    markPackagesBulk(packages, action);
+    emitPackageChanged();
+}
+
+PackageList Backend::markPackagesBulk(const QApt::PackageList &packages, QApt::Package::State action)
 {
     Q_D(Backend);
 
+    PackageList failed;
+
     if (packages.isEmpty()) {
-        return;
+        return failed;
     }
 
+    d->cancelUpgradeComputation();
+
     pkgDepCache *deps = d->cache->depCache();
     setCompressEvents(true);
 
-    foreach (Package *package, packages) {
-        const pkgCache::PkgIterator &iter = package->packageIterator();
-        switch (action) {
-        case Package::ToInstall: {
-            int state = package->staticState();
-            // Mark for install if not already installed, or if upgradeable
-            if (!(state & Package::Installed) || (state & Package::Upgradeable)) {
-                package->setInstall();
-            }
-            break;
-        }
-        case Package::ToRemove:
-            if (package->isInstalled()) {
-                package->setRemove();
-            }
-            break;
-        case Package::ToUpgrade: {
-            bool fromUser = !(package->state() & Package::IsAuto);
-            deps->MarkInstall(iter, true, 0, fromUser);
-            break;
-        }
-        case Package::ToReInstall: {
-            int state = package->staticState();
+    // Apply the raw marks first, collecting the resolver hints for every
+    // package, and only resolve once they are all in place
+    pkgProblemResolver Fix(deps);
+    bool needsResolve = false;
+    PackageList marked;
 
-            if(state & Package::Installed
-               && !(state & Package::NotDownloadable)
-               && !(state & Package::Upgradeable)) {
-                package->setReInstall();
-            }
-            break;
-        }
-        case Package::ToKeep:
-            package->setKeep();
-            break;
-        case Package::ToPurge: {
-            int state = package->staticState();
+    for (Package *package : packages) {
+        if (!BackendPrivate::applyMark(*deps, Fix, package, action, needsResolve))
+            continue;
 
-            if ((state & Package::Installed) || (state & Package::ResidualConfig)) {
-                package->setPurge();
-            }
-            break;
-        }
-        default:
-            break;
-        }
+        if (action == Package::ToKeep)
+            package->setManuallyHeld(true);
+        else if (action != Package::ToUpgrade)
+            package->setManuallyHeld(false);
+
+        marked.append(package);
+    }
+
+    d->resolveMarks(*deps, Fix, action, needsResolve);
+
+    for (Package *package : marked) {
+        if (!BackendPrivate::isMarked(*deps, package, action))
+            failed.append(package);
     }
 
     setCompressEvents(false);
-    emit packageChanged();
+
+    return failed;
+}
+
+MarkingPreview Backend::previewMarking(const QApt::PackageList &packages,
+                                       QApt::Package::State action) const
+{
+    Q_D(const Backend);
+
+    QAPT_TRACE_SPAN("Backend::previewMarking");
+
+    MarkingPreview preview;
+    pkgDepCache *liveCache = d->cache->depCache();
+
+    // Errors only mean the preview is broken, which is reported below
+    _error->PushToStack();
+
+    // A second set of states over the same (read-only) package cache
+    pkgDepCache scratch(&liveCache->GetCache(), d->cache->policy());
+    if (!scratch.Init(nullptr)) {
+        _error->RevertToStack();
+        return preview;
+    }
+
+    // Bring in the changes already pending in the live cache
+    BackendPrivate::replayMarks(scratch, d->liveMarks());
+
+    {
+        pkgDepCache::ActionGroup group(scratch);
+
+        pkgProblemResolver Fix(&scratch);
+        bool needsResolve = false;
+
+        for (const Package *package : packages) {
+            BackendPrivate::applyMark(scratch, Fix, package, action, needsResolve);
+        }
+
+        d->resolveMarks(scratch, Fix, action, needsResolve);
+    }
+
+    _error->RevertToStack();
+
+    // Only the marking-related flags can differ, the static ones are
+    // shared by both sets of states
+    for (Package *pkg : d->packages) {
+        const pkgCache::PkgIterator &iter = pkg->packageIterator();
+
+        int status = Package::dynamicState(&scratch, iter);
+        if (status == Package::dynamicState(liveCache, iter))
+            continue;
+
+        // Reduce to a single flag, the same way stateChanges() does
+        status &= (Package::Held |
+                   Package::NewInstall |
+                   Package::ToReInstall |
+                   Package::ToUpgrade |
+                   Package::ToDowngrade |
+                   Package::ToRemove);
+
+        if (status == 0)
+            continue;
+
+        preview.changes[(Package::State)status].append(pkg);
+    }
+
+    preview.downloadSizeChange = qint64(scratch.DebSize()) - qint64(liveCache->DebSize());
+    preview.installSizeChange = qint64(scratch.UsrSize()) - qint64(liveCache->UsrSize());
+    preview.isBroken = scratch.BrokenCount() > 0;
+
+    return preview;
 }
 
 void Backend::setCompressEvents(bool enabled)
@@ -1147,7 +1908,7 @@ void Backend::setCompressEvents(bool enabled)
     } else {
         delete d->actionGroup;
         d->actionGroup = nullptr;
-        emit packageChanged();
+        emitPackageChanged();
     }
 }
 
@@ -1194,11 +1955,8 @@ QApt::Transaction * Backend::commitChanges()
         }
     }
 
-    QDBusPendingReply<QString> rep = d->worker->commitChanges(packageList);
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
-
-    return trans;
+    return d->createTransaction(d->worker->commitChanges(packageList),
+                                "WorkerInterface::commitChanges");
 }
 
 QApt::Transaction * Backend::installPackages(PackageList packages)
@@ -1212,11 +1970,8 @@ QApt::Transaction * Backend::installPackages(PackageList packages)
         packageList.insert(QString::fromStdString(fullName), Package::ToInstall);
     }
 
-    QDBusPendingReply<QString> rep = d->worker->commitChanges(packageList);
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
-
-    return trans;
+    return d->createTransaction(d->worker->commitChanges(packageList),
+                                "WorkerInterface::commitChanges");
 }
 
 QApt::Transaction * Backend::removePackages(PackageList packages)
@@ -1230,11 +1985,8 @@ QApt::Transaction * Backend::removePackages(PackageList packages)
         packageList.insert(QString::fromStdString(fullName), Package::ToRemove);
     }
 
-    QDBusPendingReply<QString> rep = d->worker->commitChanges(packageList);
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
-
-    return trans;
+    return d->createTransaction(d->worker->commitChanges(packageList),
+                                "WorkerInterface::commitChanges");
 }
 
 Transaction *Backend::downloadArchives(const QString &listFile, const QString &destination)
@@ -1267,184 +2019,334 @@ Transaction *Backend::downloadArchives(const QString &listFile, const QString &d
     QDir dir(dirName);
     dir.mkdir(QLatin1String("packages"));
 
-    QDBusPendingReply<QString> rep = d->worker->downloadArchives(packages, destination);
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
-
-    return trans;
+    return d->createTransaction(d->worker->downloadArchives(packages, destination),
+                                "WorkerInterface::downloadArchives");
 }
 
 Transaction *Backend::installFile(const DebFile &debFile)
 {
     Q_D(Backend);
 
-    QDBusPendingReply<QString> rep = d->worker->installFile(debFile.filePath());
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
-
-    return trans;
+    return d->createTransaction(d->worker->installFile(debFile.filePath()),
+                                "WorkerInterface::installFile");
 }
 
 void Backend::emitPackageChanged()
 {
+    Q_D(Backend);
+
+    QAPT_TRACE_INSTANT("packageChanged");
     emit packageChanged();
+
+    if (d->trackedStates.isEmpty())
+        return;
+
+    const QVector<int> ids = updateChangeTracking();
+    if (!ids.isEmpty())
+        emit packagesChanged(ids);
 }
 
-Transaction *Backend::updateCache()
+void Backend::resetChangeTracking()
 {
     Q_D(Backend);
 
-    QDBusPendingReply<QString> rep = d->worker->updateCache();
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
+    d->trackedStates.clear();
+    d->markedIndexes.clear();
+    d->touchedIndexes.clear();
 
-    return trans;
+    if (isSignalConnected(QMetaMethod::fromSignal(&Backend::packagesChanged))) {
+        d->trackedStates.resize(d->packages.size());
+        d->touchedAll = true;
+        updateChangeTracking();
+    }
 }
 
-Transaction *Backend::upgradeSystem(UpgradeType upgradeType)
+void Backend::touchChangeTracking(const Package *package)
 {
     Q_D(Backend);
 
-    bool safeUpgrade = (upgradeType == QApt::SafeUpgrade);
-    QDBusPendingReply<QString> rep = d->worker->upgradeSystem(safeUpgrade);
-    Transaction *trans = new Transaction(rep.value());
-    trans->setFrontendCaps(d->frontendCaps);
+    if (d->trackedStates.isEmpty())
+        return;
 
-    return trans;
+    if (!package) {
+        d->touchedAll = true;
+        return;
+    }
+
+    int index = d->packageIndex(package->id());
+    if (index >= 0 && index < d->packages.size())
+        d->touchedIndexes.append(index);
 }
 
-bool Backend::saveInstalledPackagesList(const QString &path) const
+QVector<int> Backend::updateChangeTracking()
 {
-    Q_D(const Backend);
+    Q_D(Backend);
 
-    QString selectionDocument;
-    for (int i = 0; i < d->packages.size(); ++i) {
+    QAPT_TRACE_SPAN("Backend::updateChangeTracking");
+
+    QVector<int> changed;
+    if (d->packages.isEmpty())
+        return changed;
 
-        if (d->packages.at(i)->isInstalled()) {
-            selectionDocument.append(d->packages[i]->name() %
-            QLatin1String("\t\tinstall") % QLatin1Char('\n'));
+    pkgDepCache *depCache = d->cache->depCache();
+
+    // A package's marking state can only have changed if it is marked now,
+    // if it was marked before, or if one of the setters that don't mark
+    // touched it, so only those are compared
+    QVector<int> indexes;
+    if (d->touchedAll) {
+        indexes.reserve(d->packages.size());
+        for (int i = 0; i < d->packages.size(); ++i)
+            indexes.append(i);
+    } else {
+        indexes.swap(d->touchedIndexes);
+        indexes += d->markedIndexes;
+
+        // Going by the raw states is far cheaper than working out the
+        // state of every package
+        if (depCache->InstCount() + depCache->DelCount() > 0) {
+            for (pkgCache::PkgIterator iter = depCache->PkgBegin(); !iter.end(); ++iter) {
+                if ((*depCache)[iter].Mode == pkgDepCache::ModeKeep)
+                    continue;
+
+                int index = d->packageIndex(iter->ID);
+                if (index >= 0 && index < d->packages.size())
+                    indexes.append(index);
+            }
         }
+
+        std::sort(indexes.begin(), indexes.end());
+        indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
     }
 
-    if (selectionDocument.isEmpty()) {
-        return false;
+    d->touchedAll = false;
+    d->touchedIndexes.clear();
+    d->markedIndexes.clear();
+
+    BackendPrivate::TrackedState *tracked = d->trackedStates.data();
+
+    for (int i : indexes) {
+        const Package *pkg = d->packages.at(i);
+        const pkgCache::PkgIterator &iter = pkg->packageIterator();
+        const pkgDepCache::StateCache &stateCache = (*depCache)[iter];
+
+        if (stateCache.Mode != pkgDepCache::ModeKeep || (stateCache.iFlags & pkgDepCache::ReInstall))
+            d->markedIndexes.append(i);
+
+        BackendPrivate::TrackedState current;
+        current.candidate = stateCache.CandidateVer;
+        current.state = Package::dynamicState(depCache, iter);
+        if (pkg->isManuallyHeld())
+            current.state |= Package::IsManuallyHeld;
+
+        if (tracked[i].candidate == current.candidate && tracked[i].state == current.state)
+            continue;
+
+        tracked[i] = current;
+        changed.append(pkg->id());
     }
 
-    return d->writeSelectionFile(selectionDocument, path);
+    std::sort(changed.begin(), changed.end());
+
+    return changed;
 }
 
-bool Backend::saveSelections(const QString &path) const
+void Backend::connectNotify(const QMetaMethod &signal)
 {
-    Q_D(const Backend);
+    Q_D(Backend);
 
-    QString selectionDocument;
-    for (int i = 0; i < d->packages.size(); ++i) {
-        int flags = d->packages.at(i)->state();
+    if (signal == QMetaMethod::fromSignal(&Backend::packagesChanged) && d->trackedStates.isEmpty())
+        resetChangeTracking();
+}
 
-        if (flags & Package::ToInstall) {
-            selectionDocument.append(d->packages[i]->name() %
-            QLatin1String("\t\tinstall") % QLatin1Char('\n'));
-        } else if (flags & Package::ToRemove) {
-            selectionDocument.append(d->packages[i]->name() %
-            QLatin1String("\t\tdeinstall") % QLatin1Char('\n'));
+void Backend::disconnectNotify(const QMetaMethod &signal)
+{
+    Q_D(Backend);
+
+    // An invalid method means several connections went at once
+    if (!signal.isValid() || signal == QMetaMethod::fromSignal(&Backend::packagesChanged)) {
+        if (!isSignalConnected(QMetaMethod::fromSignal(&Backend::packagesChanged))) {
+            d->trackedStates = QVector<BackendPrivate::TrackedState>();
+            d->markedIndexes = QVector<int>();
+            d->touchedIndexes = QVector<int>();
         }
     }
+}
 
-    if (selectionDocument.isEmpty()) {
-        return false;
-    }
+Transaction *Backend::updateCache()
+{
+    Q_D(Backend);
 
-    return d->writeSelectionFile(selectionDocument, path);
+    return d->createTransaction(d->worker->updateCache(),
+                                "WorkerInterface::updateCache");
 }
 
-bool Backend::loadSelections(const QString &path)
+Transaction *Backend::upgradeSystem(UpgradeType upgradeType)
 {
     Q_D(Backend);
 
-    QFile file(path);
-    if (!file.open(QFile::ReadOnly)) {
-        return false;
-    }
+    bool safeUpgrade = (upgradeType == QApt::SafeUpgrade);
 
-    int lineIndex = 0;
-    QByteArray buffer = file.readAll();
+    return d->createTransaction(d->worker->upgradeSystem(safeUpgrade),
+                                "WorkerInterface::upgradeSystem");
+}
 
-    QList<QByteArray> lines = buffer.split('\n');
-    QHash<QByteArray, int> actionMap;
+bool Backend::saveInstalledPackagesList(const QString &path) const
+{
+    Q_D(const Backend);
 
-    while (lineIndex < lines.size()) {
-        QByteArray line = lines.at(lineIndex);
-        if (line.isEmpty() || line.at(0) == '#') {
-            lineIndex++;
-            continue;
-        }
+    return d->writeSelections(path, [](const pkgCache::PkgIterator &iter) -> const char * {
+        return iter.CurrentVer().end() ? nullptr : "install";
+    });
+}
 
-        line = line.trimmed();
+bool Backend::saveSelections(const QString &path) const
+{
+    Q_D(const Backend);
 
-        QByteArray aKey;
-        std::string keyString;
-        const char *data = line.constData();
-        if (ParseQuoteWord(data, keyString) == false)
-            return false;
-        aKey = QByteArray(keyString.c_str());
+    pkgDepCache *depCache = d->cache->depCache();
 
-        QByteArray aValue;
-        std::string valueString;
-        if (ParseQuoteWord(data, valueString) == false)
-            return false;
-        aValue = QByteArray(valueString.c_str());
-
-        if (aValue.at(0) == 'i') {
-            actionMap[aKey] = Package::ToInstall;
-        } else if ((aValue.at(0) == 'd') || (aValue.at(0) == 'u') || (aValue.at(0) == 'r')) {
-            actionMap[aKey] = Package::ToRemove;
-        } else if (aValue.at(0) == 'p') {
-            actionMap[aKey] = Package::ToPurge;
-        }
+    return d->writeSelections(path, [depCache](const pkgCache::PkgIterator &iter) -> const char * {
+        const pkgDepCache::StateCache &state = (*depCache)[iter];
+
+        if (state.Install())
+            return "install";
+        if (state.Delete())
+            return (state.iFlags & pkgDepCache::Purge) ? "purge" : "deinstall";
+
+        return nullptr;
+    });
+}
+
+bool Backend::loadSelections(const QString &path)
+{
+    return loadSelections(path, nullptr);
+}
 
-        ++lineIndex;
+bool Backend::loadSelections(const QString &path, SelectionsReport *report)
+{
+    Q_D(Backend);
+
+    QAPT_TRACE_SPAN("Backend::loadSelections");
+
+    if (report) {
+        *report = SelectionsReport();
     }
 
-    if (actionMap.isEmpty()) {
-       return false;
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
     }
 
+    auto skip = [report](int line, const std::string &name, SelectionsReport::Reason reason) {
+        if (report)
+            report->skipped.append({line, QString::fromStdString(name), reason});
+    };
+
+    d->cancelUpgradeComputation();
+
     pkgDepCache &cache = *d->cache->depCache();
     // Should protect whatever is already selected in the cache.
     pkgProblemResolver Fix(&cache);
+    int applied = 0;
 
-    pkgCache::PkgIterator pkgIter;
-    auto mapIter = actionMap.constBegin();
-    while (mapIter != actionMap.constEnd()) {
-        pkgIter = d->cache->depCache()->FindPkg(mapIter.key().constData());
-        if (pkgIter.end()) {
-            return false;
+    {
+        pkgDepCache::ActionGroup group(cache);
+
+        // Far longer than any package name and selection
+        char buffer[4096];
+        std::string name;
+        std::string selection;
+        int lineNumber = 0;
+
+        while (!file.atEnd()) {
+            const qint64 length = file.readLine(buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+
+            ++lineNumber;
+
+            // A full buffer without a newline is only the start of a line,
+            // unless the file ends right there
+            if (length == sizeof(buffer) - 1 && buffer[length - 1] != '\n' && !file.atEnd()) {
+                // Skip the rest of an overlong line
+                qint64 rest;
+                do {
+                    rest = file.readLine(buffer, sizeof(buffer));
+                } while (rest == sizeof(buffer) - 1 && buffer[rest - 1] != '\n' && !file.atEnd());
+
+                skip(lineNumber, std::string(), SelectionsReport::MalformedLine);
+                continue;
+            }
+
+            const char *data = buffer;
+            while (isspace(*data))
+                ++data;
+
+            // Blank lines and comments
+            if (*data == '\0' || *data == '#')
+                continue;
+
+            name.clear();
+            if (!ParseQuoteWord(data, name) || !ParseQuoteWord(data, selection)) {
+                skip(lineNumber, name, SelectionsReport::MalformedLine);
+                continue;
+            }
+
+            pkgCache::PkgIterator pkgIter = cache.FindPkg(name);
+            Package *pkg = pkgIter.end() ? nullptr : package(pkgIter);
+            if (!pkg) {
+                skip(lineNumber, name, SelectionsReport::UnknownPackage);
+                continue;
+            }
+
+            switch (selection.at(0)) {
+            case 'i':
+                Fix.Clear(pkgIter);
+                Fix.Protect(pkgIter);
+                if (pkgIter.CurrentVer().end()) { // Only mark if not already installed
+                    cache.MarkInstall(pkgIter, true);
+                }
+                break;
+            case 'h':
+                Fix.Clear(pkgIter);
+                Fix.Protect(pkgIter);
+                cache.MarkKeep(pkgIter, false);
+                pkg->setManuallyHeld(true);
+                break;
+            case 'd':
+            case 'u':
+            case 'r':
+            case 'p':
+                Fix.Clear(pkgIter);
+                Fix.Protect(pkgIter);
+                Fix.Remove(pkgIter);
+                cache.MarkDelete(pkgIter, selection.at(0) == 'p');
+                break;
+            default:
+                skip(lineNumber, name, SelectionsReport::UnknownSelection);
+                continue;
+            }
+
+            ++applied;
         }
 
-        Fix.Clear(pkgIter);
-        Fix.Protect(pkgIter);
-
-        switch (mapIter.value()) {
-           case Package::ToInstall:
-               if (pkgIter.CurrentVer().end()) { // Only mark if not already installed
-                  cache.MarkInstall(pkgIter, true);
-               }
-               break;
-           case Package::ToRemove:
-               Fix.Remove(pkgIter);
-               cache.MarkDelete(pkgIter, false);
-               break;
-           case Package::ToPurge:
-               Fix.Remove(pkgIter);
-               cache.MarkDelete(pkgIter, true);
-               break;
+        if (applied) {
+            QAPT_TRACE_SPAN("pkgProblemResolver::Resolve");
+            QMutexLocker locker(Cache::resolverMutex());
+            Fix.Resolve(true);
         }
-        ++mapIter;
     }
 
-    Fix.Resolve(true);
+    if (report) {
+        report->applied = applied;
+    }
 
-    emit packageChanged();
+    if (!applied) {
+        return false;
+    }
+
+    emitPackageChanged();
 
     return true;
 }
@@ -1553,6 +2455,7 @@ bool Backend::setPackagePinned(Package *package, bool pin)
         }
     }
 
+    QAPT_TRACE_SPAN("WorkerInterface::writeFileToDisk");
     if (!d->worker->writeFileToDisk(pinDocument, path)) {
         return false;
     }
@@ -1635,9 +2538,55 @@ bool Backend::addArchiveToCache(const DebFile &archive)
     }
 
     // Add the package, but we'll need auth so the worker'll do it
+    QAPT_TRACE_SPAN("WorkerInterface::copyArchiveToCache");
     return d->worker->copyArchiveToCache(archive.filePath());
 }
 
+void Backend::setTracingEnabled(bool enabled)
+{
+    Tracer::setEnabled(enabled);
+}
+
+bool Backend::saveTrace(const QString &path)
+{
+    return Tracer::save(path);
+}
+
+MemoryStats Backend::memoryStats() const
+{
+    Q_D(const Backend);
+
+    MemoryStats stats;
+
+    stats.packages = d->packages.size() * (Package::objectSize() + 2 * s_mallocOverhead);
+    stats.packageIndex = sizeof(QListData::Data) + d->packages.size() * sizeof(void *) +
+                         sizeof(QArrayData) + d->packagesIndex.capacity() * sizeof(int);
+    stats.groupsAndOrigins = stringSetSize(d->groups) + stringHashSize(d->originMap) +
+                             stringHashSize(d->siteMap);
+    stats.undoRedoStacks = cacheStateStackSize(d->undoStack) + cacheStateStackSize(d->redoStack);
+
+    if (d->cache && d->cache->depCache()) {
+        pkgCache &cache = d->cache->depCache()->GetCache();
+
+        stats.mappedPackageCache = cache.GetMap().Size();
+
+        // pkgRecords keeps a parser per package file, each with a tag file
+        // buffer of at least 32KiB
+        if (d->records) {
+            stats.records = sizeof(pkgRecords) +
+                            qint64(cache.Head().PackageFileCount) * (32 * 1024 + s_mallocOverhead);
+        }
+    }
+
+    stats.mappedMetadataCache = d->metadataCache.mappedSize();
+    stats.traceBuffer = Tracer::bufferSize();
+    stats.changeTracking = 3 * sizeof(QArrayData) +
+                           d->trackedStates.capacity() * sizeof(BackendPrivate::TrackedState) +
+                           (d->markedIndexes.capacity() + d->touchedIndexes.capacity()) * sizeof(int);
+
+    return stats;
+}
+
 void Backend::setFrontendCaps(FrontendCaps caps)
 {
     Q_D(Backend);
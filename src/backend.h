@@ -24,6 +24,7 @@
 #include <QHash>
 #include <QStringList>
 #include <QVariantMap>
+#include <QVector>
 
 #include "globals.h"
 #include "package.h"
@@ -46,6 +47,95 @@ namespace QApt {
 
 class BackendPrivate;
 
+/**
+ * Approximate heap and mapped memory used by the data structures of a
+ * Backend, in bytes. Container sizes are estimated from their element
+ * counts and Qt's node layouts, so they are meant for tracking budgets
+ * and regressions rather than exact accounting.
+ *
+ * @see Backend::memoryStats()
+ * @since 3.1
+ */
+struct MemoryStats
+{
+    /// Package objects and their private data
+    qint64 packages = 0;
+    /// The package list and the package ID index
+    qint64 packageIndex = 0;
+    /// Group names, and the origin/label and origin/site maps
+    qint64 groupsAndOrigins = 0;
+    /// The undo and redo stacks of cache states
+    qint64 undoRedoStacks = 0;
+    /// Estimate for the package record parsers (one per package file)
+    qint64 records = 0;
+    /// APT's binary package cache, memory-mapped from pkgcache.bin
+    qint64 mappedPackageCache = 0;
+    /// The memory-mapped metadata sidecar file, if in use
+    qint64 mappedMetadataCache = 0;
+    /// The trace event ring buffer, if tracing was ever enabled
+    qint64 traceBuffer = 0;
+    /// Package states kept for Backend::packagesChanged(), while connected
+    qint64 changeTracking = 0;
+
+    /// The sum of all of the above
+    qint64 total() const
+    {
+        return packages + packageIndex + groupsAndOrigins + undoRedoStacks +
+               records + mappedPackageCache + mappedMetadataCache + traceBuffer +
+               changeTracking;
+    }
+};
+
+/**
+ * The outcome of marking packages, as computed by Backend::previewMarking()
+ *
+ * @since 3.1
+ */
+struct MarkingPreview
+{
+    /// The packages whose state would change, grouped by their new state
+    StateChanges changes;
+    /// How much the amount of archives to download would change, in bytes
+    qint64 downloadSizeChange = 0;
+    /// How much the disk space used by installed packages would change, in bytes
+    qint64 installSizeChange = 0;
+    /// Whether the marking would leave broken packages behind
+    bool isBroken = false;
+};
+
+/**
+ * The outcome of reading a selections file with Backend::loadSelections()
+ *
+ * @since 3.1
+ */
+struct SelectionsReport
+{
+    /// Why a line of a selections file was not applied
+    enum Reason {
+        /// The line is not a package name followed by a selection
+        MalformedLine,
+        /// The package is not in the package cache, or is purely virtual
+        UnknownPackage,
+        /// The selection is not one of install, hold, deinstall or purge
+        UnknownSelection
+    };
+
+    /// A line of the selections file that was not applied
+    struct SkippedLine
+    {
+        /// The line number, starting at 1
+        int line;
+        /// The package name, if one could be read
+        QString name;
+        Reason reason;
+    };
+
+    /// The number of selections that were applied
+    int applied = 0;
+    /// The lines that were skipped, in file order
+    QVector<SkippedLine> skipped;
+};
+
 /**
  * @brief The main entry point for performing operations with the dpkg database
  *
@@ -427,6 +517,43 @@ public:
      */
     QApt::FrontendCaps frontendCaps() const;
 
+    /**
+     * Starts or stops recording trace events for the library's expensive
+     * operations, such as cache reloads, package record lookups, searches,
+     * dependency resolution and calls to the QApt Worker.
+     *
+     * Events are kept in a fixed-size ring buffer, so only the most recent
+     * ones are retained. Tracing is process-wide, covering every Backend
+     * in the process. It can also be enabled for the whole lifetime
+     * of a Backend by setting the @c QAPT_TRACE_FILE environment variable
+     * to the path the trace should be saved to.
+     *
+     * @param enabled Whether or not to record trace events
+     *
+     * @see saveTrace()
+     * @since 3.1
+     */
+    static void setTracingEnabled(bool enabled);
+
+    /**
+     * Writes the recorded trace events to a file in the Chrome trace event
+     * JSON format, which can be loaded in chrome://tracing or Perfetto.
+     *
+     * @param path The path to write the trace to
+     *
+     * @return @c true on success, @c false on failure
+     * @since 3.1
+     */
+    static bool saveTrace(const QString &path);
+
+    /**
+     * Returns how much memory the Backend's data structures are using,
+     * broken down by subsystem.
+     *
+     * @since 3.1
+     */
+    MemoryStats memoryStats() const;
+
 protected:
     BackendPrivate *const d_ptr;
 
@@ -455,6 +582,9 @@ protected:
      */
     pkgRecords *records() const;
 
+    void connectNotify(const QMetaMethod &signal) override;
+    void disconnectNotify(const QMetaMethod &signal) override;
+
 private:
     Q_DECLARE_PRIVATE(Backend)
     friend class Package;
@@ -465,6 +595,10 @@ private:
     void setInitError();
     void loadPackagePins();
     void loadReleaseDate();
+    void fillMetadataCache();
+    void resetChangeTracking();
+    void touchChangeTracking(const Package *package);
+    QVector<int> updateChangeTracking();
 
 Q_SIGNALS:
     /**
@@ -473,6 +607,23 @@ Q_SIGNALS:
      */
     void packageChanged();
 
+    /**
+     * Emitted along with packageChanged(), with the IDs of the packages
+     * whose state changed since the previous emission. Item models can use
+     * this to refresh only the affected rows, rather than querying the
+     * state of every package.
+     *
+     * Package states are only tracked while this signal is connected,
+     * which costs a few bytes per package and one pass over the package
+     * states per emission.
+     *
+     * @param ids The IDs of the changed packages, as returned by
+     * Package::id(), in ascending order
+     *
+     * @since 3.1
+     */
+    void packagesChanged(const QVector<int> &ids);
+
     /**
      * Emitted when the apt cache reload is started.
      *
@@ -528,6 +679,41 @@ Q_SIGNALS:
      */
     void transactionQueueChanged(QString active, QStringList queue);
 
+    /**
+     * Emits the progress of an upgrade being worked out by computeUpgrade()
+     *
+     * @param percentage The progress percentage of the computation
+     *
+     * @since 3.1
+     */
+    void upgradeComputationProgress(int percentage);
+
+    /**
+     * Emitted when an upgrade started with computeUpgrade() has been worked
+     * out. Nothing has been marked yet: passing @p state to
+     * restoreCacheState() applies the upgrade in one step, and ignoring it
+     * discards it.
+     *
+     * Computations that are cancelled emit upgradeComputationCancelled()
+     * instead, so every computeUpgrade() call ends in one of the two.
+     *
+     * @param state The state the cache would be in after the upgrade, or an
+     * empty state if the upgrade could not be worked out
+     *
+     * @since 3.1
+     */
+    void upgradeComputed(const QApt::CacheState &state);
+
+    /**
+     * Emitted when an upgrade started with computeUpgrade() is cancelled,
+     * whether by cancelUpgradeComputation() or by something that made its
+     * result out of date, such as marking packages or starting another
+     * computation.
+     *
+     * @since 3.1
+     */
+    void upgradeComputationCancelled();
+
 public Q_SLOTS:
    /**
     * Sets the maximum size of the undo and redo stacks.
@@ -573,6 +759,37 @@ public Q_SLOTS:
      */
     void markPackagesForDistUpgrade();
 
+    /**
+     * Works out an upgrade in a background thread, on a scratch copy of the
+     * package states, instead of blocking like markPackagesForUpgrade() and
+     * markPackagesForDistUpgrade() do. The upgrade is computed on top of the
+     * changes pending at the time of the call.
+     *
+     * Progress is reported through upgradeComputationProgress(), and the
+     * result through upgradeComputed(). Starting a new computation or
+     * reloading the cache cancels the running one.
+     *
+     * Marking packages cancels the running computation, since its result
+     * would be out of date. Since dependencies can only be resolved in one
+     * thread at a time, marking may still have to wait for a resolve the
+     * cancelled computation was already in the middle of.
+     *
+     * @param upgradeType The kind of upgrade to work out
+     *
+     * @since 3.1
+     */
+    void computeUpgrade(QApt::UpgradeType upgradeType);
+
+    /**
+     * Cancels the computation started by computeUpgrade(), if any, and
+     * emits upgradeComputationCancelled(). This returns right away, leaving
+     * the computation to wind down in the background. The cache is left
+     * untouched.
+     *
+     * @since 3.1
+     */
+    void cancelUpgradeComputation();
+
    /**
     * Marks all packages that are autoremoveable, as determined by APT. In
     * general these are packages that were automatically installed that now
@@ -610,6 +827,45 @@ public Q_SLOTS:
      */
     void markPackages(const QApt::PackageList &packages, QApt::Package::State action);
 
+    /**
+     * Marks multiple packages at once, running the dependency resolver a
+     * single time for the whole list instead of once per package. The
+     * requested packages are protected from the resolver, so it will not
+     * undo the marking of one package to satisfy another.
+     *
+     * markPackages() uses this internally, but it is mainly useful for
+     * callers that need to know which markings failed.
+     *
+     * @param packages The list of packages to be marked
+     * @param action The action to perform on the list of packages
+     *
+     * @return The packages that did not end up in the requested state
+     *
+     * @since 3.1
+     */
+    QApt::PackageList markPackagesBulk(const QApt::PackageList &packages, QApt::Package::State action);
+
+    /**
+     * Works out what marking the given packages would do, without changing
+     * the cache or emitting any signals. The marking is applied, on top of
+     * the changes already pending, to a scratch copy of the package states.
+     *
+     * Like the rest of the Backend, this must only be called from the
+     * thread the Backend lives in: it reads the pending marks and package
+     * states without locking them. Unlike marking, it leaves a running
+     * computeUpgrade() alone, since the marks it was started on stay the
+     * same.
+     *
+     * @param packages The list of packages to be marked
+     * @param action The action to perform on the list of packages
+     *
+     * @return The resulting state changes and size differences
+     *
+     * @since 3.1
+     */
+    QApt::MarkingPreview previewMarking(const QApt::PackageList &packages,
+                                        QApt::Package::State action) const;
+
     /**
      * Manual control for enabling/disabling event compression. Useful for when
      * an application needs to have its own multiple marking loop, but still wants
@@ -719,7 +975,8 @@ public Q_SLOTS:
 
     /**
      * Exports a list of all packages currently installed on the system. This
-     * list can be read by the readSelections() function or by Synaptic.
+     * list can be read by the readSelections() function, by Synaptic or by
+     * dpkg --set-selections.
      *
      * @param path The path to save the selection list to
      *
@@ -735,7 +992,7 @@ public Q_SLOTS:
 
     /**
      * Writes a list of packages that have been marked for install, removal or
-     * upgrade.
+     * upgrade, in the format of dpkg --get-selections.
      *
      * @param path The path to save the selection list to
      *
@@ -751,7 +1008,9 @@ public Q_SLOTS:
 
     /**
      * Reads and applies selections from a text file generated from either
-     * saveSelections() or from Synaptic
+     * saveSelections(), Synaptic or dpkg --get-selections.
+     *
+     * Lines naming packages that are not in the cache are skipped.
      *
      * @param path The path from which to read the selection list
      *
@@ -765,6 +1024,24 @@ public Q_SLOTS:
      */
     bool loadSelections(const QString &path);
 
+    /**
+     * Reads and applies selections like loadSelections(const QString &),
+     * reporting the lines that could not be applied.
+     *
+     * The file is read line by line, and all selections are marked in one
+     * go with a single dependency resolver run at the end.
+     *
+     * @param path The path from which to read the selection list
+     * @param report If not @c nullptr, filled with the number of applied
+     * selections and the lines that were skipped
+     *
+     * @return @c true if at least one selection was applied
+     * @return @c false if the file could not be read or had no usable lines
+     *
+     * @since 3.1
+     */
+    bool loadSelections(const QString &path, QApt::SelectionsReport *report);
+
    /**
     * Writes a list of packages that have been marked for installation. This
     * list can then be loaded with the loadDownloadList() function to start
@@ -837,6 +1114,7 @@ public Q_SLOTS:
 private Q_SLOTS:
     void emitPackageChanged();
     void emitXapianUpdateFinished();
+    void upgradeComputationFinished();
 };
 
 }
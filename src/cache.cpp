@@ -21,6 +21,7 @@
 #include "cache.h"
 
 #include <QCoreApplication>
+#include <QMutex>
 
 #include <apt-pkg/cachefile.h>
 
@@ -83,6 +84,20 @@ pkgSourceList *Cache::list() const
     return d->cache->GetSourceList();
 }
 
+pkgPolicy *Cache::policy() const
+{
+    Q_D(const Cache);
+
+    return d->cache->GetPolicy();
+}
+
+QMutex *Cache::resolverMutex()
+{
+    static QMutex mutex;
+
+    return &mutex;
+}
+
 QHash<pkgCache::PkgFileIterator, pkgIndexFile*> *Cache::trustCache() const
 {
     Q_D(const Cache);
@@ -26,8 +26,10 @@
 
 #include <apt-pkg/pkgcache.h>
 
+class QMutex;
 class pkgDepCache;
 class pkgIndexFile;
+class pkgPolicy;
 class pkgSourceList;
 
 namespace QApt {
@@ -68,6 +70,16 @@ public:
     /// Returns a pointer to the interal package source list.
     pkgSourceList *list() const;
 
+    /// Returns a pointer to the policy deciding candidate versions.
+    pkgPolicy *policy() const;
+
+    /**
+     * Returns the mutex that must be held while running a
+     * pkgProblemResolver or APT::Upgrade, since the resolver sorts through
+     * a static pointer to itself and so cannot run in two threads at once.
+     */
+    static QMutex *resolverMutex();
+
    /**
     * Returns a pointer to QApt's cache of trusted package source index
     * files. These are used by QApt::Package to determine whether or not
@@ -151,6 +151,11 @@ QString Config::readEntry(const QString &key, const QString &defaultValue) const
     return QString::fromStdString(_config->Find(key.toStdString(), defaultValue.toStdString()));
 }
 
+bool Config::exists(const QString &key) const
+{
+    return _config->Exists(key.toStdString());
+}
+
 QString Config::findDirectory(const QString &key, const QString &defaultValue) const
 {
     return QString::fromStdString(_config->FindDir(key.toStdString().data(), defaultValue.toStdString().data()));
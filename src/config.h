@@ -79,6 +79,16 @@ public:
     /** Overload for readEntry(const QString&, const bool) */
     QString readEntry(const QString &key, const QString &defaultValue) const;
 
+    /**
+     * Returns whether an entry specified by @p key has been set, even if it
+     * was set to an empty value
+     *
+     * @param key the key to search for
+     *
+     * @since 3.1
+     */
+    bool exists(const QString &key) const;
+
     /**
      * Locates the path of the given key. This uses APT's configuration
      * key algorithm to return various apt-related directories. For example,
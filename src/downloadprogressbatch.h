@@ -0,0 +1,89 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef QAPT_DOWNLOADPROGRESSBATCH_H
+#define QAPT_DOWNLOADPROGRESSBATCH_H
+
+#include <QDBusArgument>
+#include <QList>
+#include <QMetaType>
+#include <QString>
+
+namespace QApt {
+
+/**
+ * The progress of one download, as sent by the worker in the
+ * DownloadProgressBatchProperty. Marshalled as "(uittsss)".
+ *
+ * The URI and short description are only filled in when an item is first
+ * sent and whenever its status changes. Otherwise the item is referred to
+ * by its ID alone.
+ *
+ * This struct is internal to LibQApt.
+ */
+struct DownloadProgressRecord
+{
+    DownloadProgressRecord()
+        : id(0)
+        , status(0)
+        , fetchedSize(0)
+        , fileSize(0)
+    {
+    }
+
+    quint32 id;
+    /// A DownloadStatus
+    int status;
+    quint64 fetchedSize;
+    quint64 fileSize;
+    QString uri;
+    QString shortDescription;
+    QString statusMessage;
+};
+
+/// The downloads that changed since the previous batch
+typedef QList<DownloadProgressRecord> DownloadProgressBatch;
+
+inline QDBusArgument &operator<<(QDBusArgument &argument, const DownloadProgressRecord &record)
+{
+    argument.beginStructure();
+    argument << record.id << record.status << record.fetchedSize << record.fileSize
+             << record.uri << record.shortDescription << record.statusMessage;
+    argument.endStructure();
+
+    return argument;
+}
+
+inline const QDBusArgument &operator>>(const QDBusArgument &argument, DownloadProgressRecord &record)
+{
+    argument.beginStructure();
+    argument >> record.id >> record.status >> record.fetchedSize >> record.fileSize
+             >> record.uri >> record.shortDescription >> record.statusMessage;
+    argument.endStructure();
+
+    return argument;
+}
+
+}
+
+Q_DECLARE_TYPEINFO(QApt::DownloadProgressRecord, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(QApt::DownloadProgressRecord)
+
+#endif
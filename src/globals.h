@@ -21,6 +21,7 @@
 #ifndef QAPT_GLOBALS_H
 #define QAPT_GLOBALS_H
 
+#include <QDBusVariant>
 #include <QFlags>
 #include <QList>
 #include <QVariantMap>
@@ -49,6 +50,14 @@ namespace QApt
     */
     typedef QStringList GroupList;
 
+   /**
+    * Defines the PropertyMap type, which maps TransactionProperty values to
+    * their new values in batched transaction property updates
+    *
+    * @since 3.1
+    */
+    typedef QMap<int, QDBusVariant> PropertyMap;
+
    /**
     * An enumerator listing all error types that the QApt Worker can throw
     */
@@ -248,7 +257,36 @@ namespace QApt
         /// QString, the string describing the current error in detail
         ErrorDetailsProperty,
         /// int, the frontend capabilities for the transaction
-        FrontendCapsProperty
+        FrontendCapsProperty,
+        /// QVariantMap, the package changes made by a finished commit
+        ChangeManifestProperty,
+        /// int, the TransactionPriority of the transaction
+        PriorityProperty,
+        /**
+         * The downloads that changed since the last update, in a compact
+         * form. Only sent in change notifications, and turned into
+         * Transaction::downloadProgressChanged() signals by the library.
+         *
+         * @since 3.1
+         */
+        DownloadProgressBatchProperty
+    };
+
+    /**
+     * @brief An enumeration for transaction priorities
+     *
+     * Waiting transactions are run in order of priority, and a transaction
+     * may interrupt the downloads of a running one with a lower priority.
+     *
+     * @since 3.1
+     */
+    enum TransactionPriority {
+        /// For work nobody is waiting on, such as unattended downloads
+        BackgroundPriority = 0,
+        /// For work a user is waiting on. This is the default
+        InteractivePriority,
+        /// For security updates
+        SecurityPriority
     };
 
     /**
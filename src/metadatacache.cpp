@@ -0,0 +1,396 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "metadatacache.h"
+
+// Qt includes
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringBuilder>
+
+// Apt includes
+#include <apt-pkg/depcache.h>
+
+// System includes
+#include <cstring>
+#include <sys/stat.h>
+
+// Own includes
+#include "config.h" // krazy:exclude=includes
+
+namespace QApt {
+
+namespace {
+
+// Bump whenever the on-disk layout or the meaning of a stored field changes
+const quint32 s_magic = 0x51415043; // "QAPC"
+const quint32 s_version = 2;
+const int s_keySize = 20; // SHA-1
+
+// Configuration that the policy reads when picking candidate versions
+const char *const s_candidateKeys[] = {
+    "APT::Architecture",
+    "APT::Default-Release"
+};
+
+struct Header {
+    quint32 magic;
+    quint32 version;
+    char key[s_keySize];
+    quint32 packageCount;
+    quint32 versionCount;
+    quint32 pinnedCount;
+    qint32 installedCount;
+    quint64 indexOffset;
+    quint64 statesOffset;
+    quint64 pinnedOffset;
+    quint64 blobOffset;
+    quint64 blobSize;
+};
+
+quint64 align(quint64 offset)
+{
+    return (offset + 7) & ~quint64(7);
+}
+
+void addFileStamp(QCryptographicHash &hash, const QString &path)
+{
+    hash.addData(QFile::encodeName(path));
+
+    struct stat buf;
+    if (::stat(QFile::encodeName(path).constData(), &buf) != 0) {
+        hash.addData("-", 1);
+        return;
+    }
+
+    const qint64 stamp[] = { qint64(buf.st_ino), qint64(buf.st_size),
+                             qint64(buf.st_mtim.tv_sec), qint64(buf.st_mtim.tv_nsec) };
+    hash.addData(reinterpret_cast<const char *>(stamp), sizeof(stamp));
+}
+
+void addDirectoryStamp(QCryptographicHash &hash, const QString &path, bool withEntries)
+{
+    // Adding or removing a file bumps the mtime of the directory, but
+    // editing a file in place does not
+    addFileStamp(hash, path);
+
+    if (!withEntries)
+        return;
+
+    QDir dir(path);
+    const QStringList entries = dir.entryList(QDir::Files, QDir::Name);
+    for (const QString &entry : entries) {
+        addFileStamp(hash, dir.filePath(entry));
+    }
+}
+
+}
+
+MetadataCache::MetadataCache()
+    : m_map(nullptr)
+    , m_mapSize(0)
+    , m_packageCount(0)
+    , m_index(nullptr)
+    , m_states(nullptr)
+    , m_pinned(nullptr)
+    , m_pinnedCount(0)
+    , m_installedCount(0)
+{
+}
+
+MetadataCache::~MetadataCache()
+{
+    close();
+}
+
+QString MetadataCache::path(const Config *config)
+{
+    // An explicitly empty value turns the cache off
+    if (config->exists(QLatin1String("QApt::MetadataCache"))) {
+        return config->findFile(QLatin1String("QApt::MetadataCache"));
+    }
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    if (dir.isEmpty())
+        return QString();
+
+    return dir % QLatin1String("/libqapt/metadata.cache");
+}
+
+QByteArray MetadataCache::computeKey(const Config *config)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    hash.addData(reinterpret_cast<const char *>(&s_version), sizeof(s_version));
+
+    // File stamps rather than contents, so that computing the key stays
+    // far cheaper than the reload it lets us skip. Everything here is
+    // replaced by rename or rewritten when it changes.
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::Cache::pkgcache")));
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::State::status")));
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::State::extended_states")));
+    addDirectoryStamp(hash, config->findDirectory(QLatin1String("Dir::State::Lists")), false);
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::Etc::sourcelist")));
+    addDirectoryStamp(hash, config->findDirectory(QLatin1String("Dir::Etc::sourceparts")), true);
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::Etc::preferences")));
+    addDirectoryStamp(hash, config->findDirectory(QLatin1String("Dir::Etc::preferencesparts")), true);
+    // Used for the release date
+    addFileStamp(hash, QLatin1String("/etc/os-release"));
+    addDirectoryStamp(hash, QLatin1String("/usr/share/distro-info"), true);
+    // Options that are set from apt.conf rather than the files above
+    addFileStamp(hash, config->findFile(QLatin1String("Dir::Etc::main")));
+    addDirectoryStamp(hash, config->findDirectory(QLatin1String("Dir::Etc::parts")), true);
+
+    hash.addData(config->architectures().join(QLatin1Char(',')).toLatin1());
+
+    // Values that change candidates can also be set at runtime, without
+    // touching any file
+    for (const char *key : s_candidateKeys) {
+        const QString value = config->readEntry(QLatin1String(key), QString());
+        hash.addData(key, std::strlen(key) + 1);
+        hash.addData(value.toUtf8().append('\0'));
+    }
+
+    return hash.result();
+}
+
+bool MetadataCache::open(const QString &path, const QByteArray &key, pkgDepCache *depCache)
+{
+    close();
+
+    if (path.isEmpty() || key.size() != s_keySize)
+        return false;
+
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::ReadOnly))
+        return false;
+
+    const qint64 size = m_file.size();
+    if (size < qint64(sizeof(Header))) {
+        m_file.close();
+        return false;
+    }
+
+    uchar *map = m_file.map(0, size);
+    if (!map) {
+        m_file.close();
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, map, sizeof(Header));
+
+    const quint32 packageCount = depCache->Head().PackageCount;
+    bool valid = header.magic == s_magic
+            && header.version == s_version
+            && memcmp(header.key, key.constData(), s_keySize) == 0
+            && header.packageCount == packageCount
+            && header.versionCount == depCache->Head().VersionCount
+            && header.indexOffset + quint64(packageCount) * sizeof(qint32) <= quint64(size)
+            && header.statesOffset + quint64(packageCount) * sizeof(quint32) <= quint64(size)
+            && header.pinnedOffset + quint64(header.pinnedCount) * sizeof(quint32) <= quint64(size)
+            && header.blobOffset + header.blobSize <= quint64(size);
+
+    if (!valid) {
+        m_file.unmap(map);
+        m_file.close();
+        return false;
+    }
+
+    // Small, variable-sized tables are deserialized, the per-package
+    // tables are used in place
+    QByteArray blob = QByteArray::fromRawData(reinterpret_cast<const char *>(map + header.blobOffset),
+                                              int(header.blobSize));
+    QDataStream stream(blob);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream >> m_groups >> m_originMap >> m_siteMap >> m_releaseDate;
+
+    if (stream.status() != QDataStream::Ok) {
+        m_file.unmap(map);
+        m_file.close();
+        m_groups.clear();
+        m_originMap.clear();
+        m_siteMap.clear();
+        m_releaseDate = QDateTime();
+        return false;
+    }
+
+    m_map = map;
+    m_mapSize = size;
+    m_key = key;
+    m_packageCount = packageCount;
+    m_installedCount = header.installedCount;
+    m_index = reinterpret_cast<const qint32 *>(map + header.indexOffset);
+    m_states = reinterpret_cast<const quint32 *>(map + header.statesOffset);
+    m_pinned = reinterpret_cast<const quint32 *>(map + header.pinnedOffset);
+    m_pinnedCount = header.pinnedCount;
+
+    return true;
+}
+
+bool MetadataCache::write(const QString &path, const QByteArray &key,
+                          pkgDepCache *depCache, const Data &data)
+{
+    const quint32 packageCount = depCache->Head().PackageCount;
+
+    if (path.isEmpty() || key.size() != s_keySize ||
+        data.packagesIndex.size() != int(packageCount) ||
+        data.staticStates.size() != int(packageCount)) {
+        return false;
+    }
+
+    QByteArray blob;
+    QDataStream stream(&blob, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << data.groups << data.originMap << data.siteMap << data.releaseDate;
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    header.magic = s_magic;
+    header.version = s_version;
+    memcpy(header.key, key.constData(), s_keySize);
+    header.packageCount = packageCount;
+    header.versionCount = depCache->Head().VersionCount;
+    header.pinnedCount = data.pinnedIds.size();
+    header.installedCount = data.installedCount;
+    header.indexOffset = align(sizeof(Header));
+    header.statesOffset = align(header.indexOffset + packageCount * sizeof(qint32));
+    header.pinnedOffset = align(header.statesOffset + packageCount * sizeof(quint32));
+    header.blobOffset = align(header.pinnedOffset + header.pinnedCount * sizeof(quint32));
+    header.blobSize = blob.size();
+
+    QByteArray buffer(int(header.blobOffset + header.blobSize), '\0');
+    char *out = buffer.data();
+    memcpy(out, &header, sizeof(Header));
+    memcpy(out + header.indexOffset, data.packagesIndex.constData(),
+           packageCount * sizeof(qint32));
+    memcpy(out + header.statesOffset, data.staticStates.constData(),
+           packageCount * sizeof(quint32));
+    memcpy(out + header.pinnedOffset, data.pinnedIds.constData(),
+           header.pinnedCount * sizeof(quint32));
+    memcpy(out + header.blobOffset, blob.constData(), blob.size());
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    // Readers in other processes keep their mapping of the old file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    if (file.write(buffer) != buffer.size()) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+void MetadataCache::close()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+    }
+    m_file.close();
+
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_key.clear();
+    m_packageCount = 0;
+    m_index = nullptr;
+    m_states = nullptr;
+    m_pinned = nullptr;
+    m_pinnedCount = 0;
+    m_installedCount = 0;
+    m_releaseDate = QDateTime();
+    m_groups.clear();
+    m_originMap.clear();
+    m_siteMap.clear();
+}
+
+bool MetadataCache::isOpen() const
+{
+    return m_map;
+}
+
+QByteArray MetadataCache::key() const
+{
+    return m_key;
+}
+
+qint64 MetadataCache::mappedSize() const
+{
+    return m_mapSize;
+}
+
+int MetadataCache::packageIndex(int id) const
+{
+    if (id < 0 || quint32(id) >= m_packageCount)
+        return -1;
+
+    return m_index[id];
+}
+
+quint32 MetadataCache::staticState(int id) const
+{
+    if (id < 0 || quint32(id) >= m_packageCount)
+        return 0;
+
+    return m_states[id];
+}
+
+QVector<quint32> MetadataCache::pinnedIds() const
+{
+    QVector<quint32> ids(m_pinnedCount);
+    if (m_pinnedCount)
+        memcpy(ids.data(), m_pinned, m_pinnedCount * sizeof(quint32));
+
+    return ids;
+}
+
+int MetadataCache::installedCount() const
+{
+    return m_installedCount;
+}
+
+QDateTime MetadataCache::releaseDate() const
+{
+    return m_releaseDate;
+}
+
+QSet<QString> MetadataCache::groups() const
+{
+    return m_groups;
+}
+
+QHash<QString, QString> MetadataCache::originMap() const
+{
+    return m_originMap;
+}
+
+QHash<QString, QString> MetadataCache::siteMap() const
+{
+    return m_siteMap;
+}
+
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef QAPT_METADATACACHE_H
+#define QAPT_METADATACACHE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+class pkgDepCache;
+
+namespace QApt {
+
+class Config;
+
+/**
+ * The MetadataCache class manages a versioned, memory-mapped sidecar file
+ * holding the tables QApt::Backend derives while reloading the APT cache.
+ * (The package index, static state flags, groups, origins, pins and the
+ * release date.)
+ *
+ * The file is keyed by a fingerprint of everything those tables are
+ * computed from, so a Backend in another process can map it in instead of
+ * walking the whole package cache again. The index and state tables are
+ * used straight from the mapping, letting processes share their pages.
+ *
+ * This class is internal to LibQApt.
+ */
+class MetadataCache
+{
+public:
+    /// The derived tables, as computed by a full cache reload
+    struct Data {
+        Data() : installedCount(0) {}
+
+        /// Position in the package list for each package ID, or -1
+        QVector<qint32> packagesIndex;
+        /// Static Package::State flags for each package ID, without the
+        /// ones the depcache decides on
+        QVector<quint32> staticStates;
+        /// IDs of the packages that have a pin
+        QVector<quint32> pinnedIds;
+        QSet<QString> groups;
+        QHash<QString, QString> originMap;
+        QHash<QString, QString> siteMap;
+        QDateTime releaseDate;
+        int installedCount;
+    };
+
+    MetadataCache();
+    ~MetadataCache();
+
+    /**
+     * Returns the path of the sidecar file. Can be overridden with the
+     * QApt::MetadataCache APT configuration key, an empty value disables
+     * the cache.
+     */
+    static QString path(const Config *config);
+
+    /**
+     * Returns a fingerprint of the files the derived tables depend on.
+     * (pkgcache.bin, the dpkg status and extended states files, the
+     * package lists, sources, preferences and distro-info)
+     */
+    static QByteArray computeKey(const Config *config);
+
+    /**
+     * Maps the sidecar file at @p path, provided it was written with
+     * @p key for a package cache with the same layout as @p depCache.
+     *
+     * @return @c true if the file is mapped and can be used
+     */
+    bool open(const QString &path, const QByteArray &key, pkgDepCache *depCache);
+
+    /**
+     * Atomically replaces the sidecar file at @p path with @p data
+     *
+     * @return @c true on success
+     */
+    static bool write(const QString &path, const QByteArray &key,
+                      pkgDepCache *depCache, const Data &data);
+
+    /// Unmaps the sidecar file
+    void close();
+
+    bool isOpen() const;
+    QByteArray key() const;
+    qint64 mappedSize() const;
+
+    int packageIndex(int id) const;
+    quint32 staticState(int id) const;
+    QVector<quint32> pinnedIds() const;
+    int installedCount() const;
+    QDateTime releaseDate() const;
+    QSet<QString> groups() const;
+    QHash<QString, QString> originMap() const;
+    QHash<QString, QString> siteMap() const;
+
+private:
+    QFile m_file;
+    QByteArray m_key;
+    uchar *m_map;
+    qint64 m_mapSize;
+    quint32 m_packageCount;
+    const qint32 *m_index;
+    const quint32 *m_states;
+    const quint32 *m_pinned;
+    quint32 m_pinnedCount;
+    int m_installedCount;
+    QDateTime m_releaseDate;
+    QSet<QString> m_groups;
+    QHash<QString, QString> m_originMap;
+    QHash<QString, QString> m_siteMap;
+};
+
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QFile>
+#include <QMutex>
 #include <QStringBuilder>
 #include <QStringList>
 #include <QTemporaryFile>
@@ -55,6 +56,7 @@
 #include "cache.h"
 #include "config.h" // krazy:exclude=includes
 #include "markingerrorinfo.h"
+#include "tracer.h"
 
 namespace QApt {
 
@@ -66,6 +68,7 @@ class PackagePrivate
             , backend(back)
             , state(0)
             , staticStateCalculated(false)
+            , depCacheStateCalculated(false)
             , foreignArchCalculated(false)
             , isInUpdatePhase(false)
             , inUpdatePhaseCalculated(false)
@@ -80,6 +83,7 @@ class PackagePrivate
         QApt::Backend *backend;
         int state;
         bool staticStateCalculated;
+        bool depCacheStateCalculated;
         bool isForeignArch;
         bool foreignArchCalculated;
         bool isInUpdatePhase;
@@ -87,8 +91,18 @@ class PackagePrivate
 
         pkgCache::PkgFileIterator searchPkgFileIter(QLatin1String label, const QString &release) const;
 
+        template<typename FileIterator>
+        pkgRecords::Parser &lookupRecord(const FileIterator &file) const
+        {
+            QAPT_TRACE_SPAN("pkgRecords::Lookup");
+            return backend->records()->Lookup(file);
+        }
+
         // Calculate state flags that cannot change
         void initStaticState(const pkgCache::VerIterator &ver, pkgDepCache::StateCache &stateCache);
+        // Calculate the static flags the depcache decides on
+        void initDepCacheState(const pkgDepCache::StateCache &stateCache);
+        void ensureStaticState();
 
         bool setInUpdatePhase(bool inUpdatePhase);
 };
@@ -146,6 +160,37 @@ void PackagePrivate::initStaticState(const pkgCache::VerIterator &ver, pkgDepCac
         packageState |= QApt::Package::NotInstalled;
     }
 
+    // Essential/important status can only be changed by cache reload
+    if (packageIter->Flags & (pkgCache::Flag::Important |
+                             pkgCache::Flag::Essential)) {
+        packageState |= QApt::Package::IsImportant;
+    }
+
+    if (packageIter->CurrentState == pkgCache::State::ConfigFiles) {
+        packageState |= QApt::Package::ResidualConfig;
+    }
+
+    // Packages will stay undownloadable until a sources file is refreshed
+    // and the cache is reloaded.
+    bool downloadable = true;
+    if (!stateCache.CandidateVer ||
+        !stateCache.CandidateVerIter(*backend->cache()->depCache()).Downloadable())
+        downloadable = false;
+
+    if (!downloadable)
+        packageState |= QApt::Package::NotDownloadable;
+
+    state |= packageState;
+
+    staticStateCalculated = true;
+
+    initDepCacheState(stateCache);
+}
+
+void PackagePrivate::initDepCacheState(const pkgDepCache::StateCache &stateCache)
+{
+    int packageState = 0;
+
     // Broken/garbage statuses are constant until a cache reload
     if (stateCache.NowBroken()) {
         packageState |= QApt::Package::NowBroken;
@@ -167,29 +212,21 @@ void PackagePrivate::initStaticState(const pkgCache::VerIterator &ver, pkgDepCac
         packageState |= QApt::Package::InstallPolicyBroken;
     }
 
-    // Essential/important status can only be changed by cache reload
-    if (packageIter->Flags & (pkgCache::Flag::Important |
-                             pkgCache::Flag::Essential)) {
-        packageState |= QApt::Package::IsImportant;
-    }
-
-    if (packageIter->CurrentState == pkgCache::State::ConfigFiles) {
-        packageState |= QApt::Package::ResidualConfig;
-    }
-
-    // Packages will stay undownloadable until a sources file is refreshed
-    // and the cache is reloaded.
-    bool downloadable = true;
-    if (!stateCache.CandidateVer ||
-        !stateCache.CandidateVerIter(*backend->cache()->depCache()).Downloadable())
-        downloadable = false;
+    state |= packageState;
 
-    if (!downloadable)
-        packageState |= QApt::Package::NotDownloadable;
+    depCacheStateCalculated = true;
+}
 
-    state |= packageState;
+void PackagePrivate::ensureStaticState()
+{
+    pkgDepCache::StateCache &stateCache = (*backend->cache()->depCache())[packageIter];
 
-    staticStateCalculated = true;
+    if (!staticStateCalculated) {
+        initStaticState(packageIter.CurrentVer(), stateCache);
+    } else if (!depCacheStateCalculated) {
+        // Seeded by setStaticState()
+        initDepCacheState(stateCache);
+    }
 }
 
 bool PackagePrivate::setInUpdatePhase(bool inUpdatePhase)
@@ -241,7 +278,7 @@ QString Package::sourcePackage() const
     // name
     const pkgCache::VerIterator &ver = (*d->backend->cache()->depCache()).GetCandidateVersion(d->packageIter);
     if (!ver.end()) {
-        pkgRecords::Parser &rec = d->backend->records()->Lookup(ver.FileList());
+        pkgRecords::Parser &rec = d->lookupRecord(ver.FileList());
         sourcePackage = QString::fromStdString(rec.SourcePkg());
     }
 
@@ -260,7 +297,7 @@ QString Package::shortDescription() const
     const pkgCache::VerIterator &ver = (*d->backend->cache()->depCache()).GetCandidateVersion(d->packageIter);
     if (!ver.end()) {
         pkgCache::DescIterator Desc = ver.TranslatedDescription();
-        pkgRecords::Parser & parser = d->backend->records()->Lookup(Desc.FileList());
+        pkgRecords::Parser & parser = d->lookupRecord(Desc.FileList());
         shortDescription = QString::fromUtf8(parser.ShortDesc().data());
         return shortDescription;
     }
@@ -275,7 +312,7 @@ QString Package::longDescription() const
     if (!ver.end()) {
         QString rawDescription;
         pkgCache::DescIterator Desc = ver.TranslatedDescription();
-        pkgRecords::Parser & parser = d->backend->records()->Lookup(Desc.FileList());
+        pkgRecords::Parser & parser = d->lookupRecord(Desc.FileList());
         rawDescription = QString::fromUtf8(parser.LongDesc().data());
         // Apt acutally returns the whole description, we just want the
         // extended part.
@@ -317,7 +354,7 @@ QString Package::maintainer() const
     QString maintainer;
     const pkgCache::VerIterator &ver = (*d->backend->cache()->depCache()).GetCandidateVersion(d->packageIter);
     if (!ver.end()) {
-        pkgRecords::Parser &parser = d->backend->records()->Lookup(ver.FileList());
+        pkgRecords::Parser &parser = d->lookupRecord(ver.FileList());
         maintainer = QString::fromUtf8(parser.Maintainer().data());
         // This replacement prevents frontends from interpreting '<' as
         // an HTML tag opening
@@ -331,7 +368,7 @@ QString Package::homepage() const
     QString homepage;
     const pkgCache::VerIterator &ver = (*d->backend->cache()->depCache()).GetCandidateVersion(d->packageIter);
     if (!ver.end()) {
-        pkgRecords::Parser &parser = d->backend->records()->Lookup(ver.FileList());
+        pkgRecords::Parser &parser = d->lookupRecord(ver.FileList());
         homepage = QString::fromUtf8(parser.Homepage().data());
     }
     return homepage;
@@ -540,7 +577,7 @@ QByteArray Package::md5Sum() const
     if(ver.end())
         return QByteArray();
 
-    pkgRecords::Parser &rec = d->backend->records()->Lookup(ver.FileList());
+    pkgRecords::Parser &rec = d->lookupRecord(ver.FileList());
 
     auto MD5HashString = rec.Hashes().find("MD5Sum");
 
@@ -627,7 +664,7 @@ QString Package::controlField(QLatin1String name) const
         return QString();
     }
 
-    pkgRecords::Parser &rec = d->backend->records()->Lookup(ver.FileList());
+    pkgRecords::Parser &rec = d->lookupRecord(ver.FileList());
 
     return QString::fromStdString(rec.RecordField(name.latin1()));
 }
@@ -680,14 +717,18 @@ qint64 Package::downloadSize() const
 
 int Package::state() const
 {
-    int packageState = 0;
+    if (!d->staticStateCalculated || !d->depCacheStateCalculated) {
+        d->ensureStaticState();
+    }
 
-    const pkgCache::VerIterator &ver = d->packageIter.CurrentVer();
-    pkgDepCache::StateCache &stateCache = (*d->backend->cache()->depCache())[d->packageIter];
+    return dynamicState(d->backend->cache()->depCache(), d->packageIter) | d->state;
+}
 
-    if (!d->staticStateCalculated) {
-        d->initStaticState(ver, stateCache);
-    }
+int Package::dynamicState(pkgDepCache *depCache, const pkgCache::PkgIterator &iter)
+{
+    int packageState = 0;
+
+    const pkgDepCache::StateCache &stateCache = (*depCache)[iter];
 
     if (stateCache.Install()) {
         packageState |= ToInstall;
@@ -717,20 +758,40 @@ int Package::state() const
         }
     }
 
-   return packageState | d->state;
+    return packageState;
 }
 
 int Package::staticState() const
 {
-    if (!d->staticStateCalculated) {
-        const pkgCache::VerIterator &ver = d->packageIter.CurrentVer();
-        pkgDepCache::StateCache &stateCache = (*d->backend->cache()->depCache())[d->packageIter];
-        d->initStaticState(ver, stateCache);
+    if (!d->staticStateCalculated || !d->depCacheStateCalculated) {
+        d->ensureStaticState();
     }
 
     return d->state;
 }
 
+void Package::setStaticState(int state)
+{
+    d->state |= state;
+    d->staticStateCalculated = true;
+}
+
+qint64 Package::objectSize()
+{
+    return sizeof(Package) + sizeof(PackagePrivate);
+}
+
+void Package::setManuallyHeld(bool held)
+{
+    held ? d->state |= IsManuallyHeld : d->state &= ~IsManuallyHeld;
+    d->backend->touchChangeTracking(this);
+}
+
+bool Package::isManuallyHeld() const
+{
+    return d->state & IsManuallyHeld;
+}
+
 int Package::compareVersion(const QString &v1, const QString &v2)
 {
     // Make deep copies of toStdString(), since otherwise they would
@@ -1237,21 +1298,27 @@ bool Package::wouldBreak() const
 void Package::setAuto(bool flag)
 {
     d->backend->cache()->depCache()->MarkAuto(d->packageIter, flag);
+    d->backend->touchChangeTracking(this);
 }
 
 
 void Package::setKeep()
 {
+    // The pending upgrade computation is based on the old marks
+    d->backend->cancelUpgradeComputation();
+
     d->backend->cache()->depCache()->MarkKeep(d->packageIter, false);
     if (state() & ToReInstall) {
         d->backend->cache()->depCache()->SetReInstall(d->packageIter, false);
     }
     if (d->backend->cache()->depCache()->BrokenCount() > 0) {
+        QAPT_TRACE_SPAN("pkgProblemResolver::ResolveByKeep");
+        QMutexLocker locker(Cache::resolverMutex());
         pkgProblemResolver Fix(d->backend->cache()->depCache());
         Fix.ResolveByKeep();
     }
 
-    d->state |= IsManuallyHeld;
+    setManuallyHeld(true);
 
     if (!d->backend->areEventsCompressed()) {
         d->backend->emitPackageChanged();
@@ -1260,12 +1327,16 @@ void Package::setKeep()
 
 void Package::setInstall()
 {
+    d->backend->cancelUpgradeComputation();
+
     d->backend->cache()->depCache()->MarkInstall(d->packageIter, true);
-    d->state &= ~IsManuallyHeld;
+    setManuallyHeld(false);
 
     // FIXME: can't we get rid of it here?
     // if there is something wrong, try to fix it
     if (!(state() & ToInstall) || d->backend->cache()->depCache()->BrokenCount() > 0) {
+        QAPT_TRACE_SPAN("pkgProblemResolver::Resolve");
+        QMutexLocker locker(Cache::resolverMutex());
         pkgProblemResolver Fix(d->backend->cache()->depCache());
         Fix.Clear(d->packageIter);
         Fix.Protect(d->packageIter);
@@ -1279,8 +1350,10 @@ void Package::setInstall()
 
 void Package::setReInstall()
 {
+    d->backend->cancelUpgradeComputation();
+
     d->backend->cache()->depCache()->SetReInstall(d->packageIter, true);
-    d->state &= ~IsManuallyHeld;
+    setManuallyHeld(false);
 
     if (!d->backend->areEventsCompressed()) {
         d->backend->emitPackageChanged();
@@ -1290,18 +1363,24 @@ void Package::setReInstall()
 // TODO: merge into one function with bool_purge param
 void Package::setRemove()
 {
-    pkgProblemResolver Fix(d->backend->cache()->depCache());
+    d->backend->cancelUpgradeComputation();
+
+    {
+        QAPT_TRACE_SPAN("pkgProblemResolver::Resolve");
+        QMutexLocker locker(Cache::resolverMutex());
+        pkgProblemResolver Fix(d->backend->cache()->depCache());
 
-    Fix.Clear(d->packageIter);
-    Fix.Protect(d->packageIter);
-    Fix.Remove(d->packageIter);
+        Fix.Clear(d->packageIter);
+        Fix.Protect(d->packageIter);
+        Fix.Remove(d->packageIter);
 
-    d->backend->cache()->depCache()->SetReInstall(d->packageIter, false);
-    d->backend->cache()->depCache()->MarkDelete(d->packageIter, false);
+        d->backend->cache()->depCache()->SetReInstall(d->packageIter, false);
+        d->backend->cache()->depCache()->MarkDelete(d->packageIter, false);
 
-    Fix.Resolve(true);
+        Fix.Resolve(true);
+    }
 
-    d->state &= ~IsManuallyHeld;
+    setManuallyHeld(false);
 
     if (!d->backend->areEventsCompressed()) {
         d->backend->emitPackageChanged();
@@ -1310,18 +1389,24 @@ void Package::setRemove()
 
 void Package::setPurge()
 {
-    pkgProblemResolver Fix(d->backend->cache()->depCache());
+    d->backend->cancelUpgradeComputation();
+
+    {
+        QAPT_TRACE_SPAN("pkgProblemResolver::Resolve");
+        QMutexLocker locker(Cache::resolverMutex());
+        pkgProblemResolver Fix(d->backend->cache()->depCache());
 
-    Fix.Clear(d->packageIter);
-    Fix.Protect(d->packageIter);
-    Fix.Remove(d->packageIter);
+        Fix.Clear(d->packageIter);
+        Fix.Protect(d->packageIter);
+        Fix.Remove(d->packageIter);
 
-    d->backend->cache()->depCache()->SetReInstall(d->packageIter, false);
-    d->backend->cache()->depCache()->MarkDelete(d->packageIter, true);
+        d->backend->cache()->depCache()->SetReInstall(d->packageIter, false);
+        d->backend->cache()->depCache()->MarkDelete(d->packageIter, true);
 
-    Fix.Resolve(true);
+        Fix.Resolve(true);
+    }
 
-    d->state &= ~IsManuallyHeld;
+    setManuallyHeld(false);
 
     if (!d->backend->areEventsCompressed()) {
         d->backend->emitPackageChanged();
@@ -1350,6 +1435,9 @@ bool Package::setVersion(const QString &version)
         break;
     }
 
+    // Changing the release can change the candidates of dependencies too
+    d->backend->touchChangeTracking(nullptr);
+
     if (isDefault)
         d->state &= ~OverrideVersion;
     else
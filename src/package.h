@@ -32,6 +32,8 @@
 #include "dependencyinfo.h"
 #include "globals.h"
 
+class pkgDepCache;
+
 namespace QApt {
 
 class Backend;
@@ -675,6 +677,41 @@ private:
       */
      int staticState() const;
 
+     /**
+      * Seeds the static state flags with a previously computed value, so
+      * that they need not be calculated again after a cache reload.
+      *
+      * The broken and garbage flags are not part of the seed. They are
+      * still computed from the depcache when first needed, since they depend
+      * on configuration that can change without touching any file.
+      */
+     void setStaticState(int state);
+
+     /**
+      * Returns the memory taken by a package object and its private data
+      */
+     static qint64 objectSize();
+
+     /**
+      * Sets or clears the IsManuallyHeld flag, for marking done on the
+      * package's behalf by the Backend
+      */
+     void setManuallyHeld(bool held);
+
+     /**
+      * Returns whether the IsManuallyHeld flag is set, without working out
+      * the rest of the static state
+      */
+     bool isManuallyHeld() const;
+
+     /**
+      * Returns the marking-related state flags of the package described by
+      * @p iter in @p depCache. (Everything but the static state)
+      * Does not touch any Package object, so it can be used on other
+      * dependency caches and from several threads at once.
+      */
+     static int dynamicState(pkgDepCache *depCache, const pkgCache::PkgIterator &iter);
+
      friend class Backend;
 };
 
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#include "tracer.h"
+
+// Qt includes
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QThread>
+
+namespace QApt {
+
+namespace {
+
+// Enough for a couple of cache reloads' worth of spans, ~3MB
+const quint64 s_capacity = 1 << 16;
+
+// Marks a slot that a writer is filling in
+const quint64 s_writing = ~quint64(0);
+
+// Written and read field by field with relaxed atomics; the sequence
+// number tells readers whether they got one whole event
+struct TraceEvent {
+    // The ring buffer position plus one, 0 while empty
+    std::atomic<quint64> sequence;
+    std::atomic<const char *> name;
+    std::atomic<qint64> timestamp;
+    // Duration for spans, the value for counters
+    std::atomic<qint64> value;
+    std::atomic<quintptr> thread;
+    std::atomic<char> phase;
+};
+
+struct EventData {
+    const char *name;
+    qint64 timestamp;
+    qint64 value;
+    quintptr thread;
+    char phase;
+};
+
+struct TraceBuffer {
+    TraceBuffer()
+        : events(new TraceEvent[s_capacity]())
+        , next(0)
+    {
+        timer.start();
+    }
+
+    // Never freed, so that a late trace point in another thread can't
+    // write into released memory
+    TraceEvent *const events;
+    std::atomic<quint64> next;
+    QElapsedTimer timer;
+};
+
+std::atomic<bool> s_allocated(false);
+
+TraceBuffer *traceBuffer()
+{
+    static TraceBuffer *buffer = new TraceBuffer;
+    s_allocated.store(true, std::memory_order_relaxed);
+    return buffer;
+}
+
+void record(char phase, const char *name, qint64 timestamp, qint64 value)
+{
+    TraceBuffer *buffer = traceBuffer();
+
+    // Once the buffer wraps around, the oldest events are overwritten
+    const quint64 position = buffer->next.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[position % s_capacity];
+
+    // A writer that has lapped the whole buffer while another is still
+    // filling this slot in drops its event rather than mixing the two
+    if (event.sequence.exchange(s_writing, std::memory_order_acquire) == s_writing)
+        return;
+
+    event.name.store(name, std::memory_order_relaxed);
+    event.timestamp.store(timestamp, std::memory_order_relaxed);
+    event.value.store(value, std::memory_order_relaxed);
+    event.thread.store(quintptr(QThread::currentThreadId()), std::memory_order_relaxed);
+    event.phase.store(phase, std::memory_order_relaxed);
+    event.sequence.store(position + 1, std::memory_order_release);
+}
+
+// Copies the event recorded at @p position, if it is still in the buffer
+// and no writer touched it while copying
+bool load(const TraceBuffer *buffer, quint64 position, EventData &data)
+{
+    const TraceEvent &event = buffer->events[position % s_capacity];
+
+    if (event.sequence.load(std::memory_order_acquire) != position + 1)
+        return false;
+
+    data.name = event.name.load(std::memory_order_relaxed);
+    data.timestamp = event.timestamp.load(std::memory_order_relaxed);
+    data.value = event.value.load(std::memory_order_relaxed);
+    data.thread = event.thread.load(std::memory_order_relaxed);
+    data.phase = event.phase.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return event.sequence.load(std::memory_order_relaxed) == position + 1;
+}
+
+}
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+void Tracer::setEnabled(bool enabled)
+{
+    if (enabled)
+        traceBuffer();
+
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+qint64 Tracer::now()
+{
+    return traceBuffer()->timer.nsecsElapsed() / 1000;
+}
+
+void Tracer::complete(const char *name, qint64 start)
+{
+    record('X', name, start, now() - start);
+}
+
+void Tracer::instant(const char *name)
+{
+    record('i', name, now(), 0);
+}
+
+void Tracer::counter(const char *name, qint64 value)
+{
+    record('C', name, now(), value);
+}
+
+void Tracer::clear()
+{
+    TraceBuffer *buffer = traceBuffer();
+
+    buffer->next.store(0, std::memory_order_relaxed);
+    for (quint64 i = 0; i < s_capacity; ++i) {
+        buffer->events[i].sequence.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool Tracer::save(const QString &path)
+{
+    TraceBuffer *buffer = traceBuffer();
+
+    const quint64 next = buffer->next.load(std::memory_order_relaxed);
+    const quint64 count = qMin(next, s_capacity);
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    QJsonArray events;
+    for (quint64 i = next - count; i < next; ++i) {
+        EventData event;
+        if (!load(buffer, i, event))
+            continue;
+
+        QJsonObject object;
+        object.insert(QLatin1String("name"), QLatin1String(event.name));
+        object.insert(QLatin1String("cat"), QLatin1String("qapt"));
+        object.insert(QLatin1String("ph"), QString(QLatin1Char(event.phase)));
+        object.insert(QLatin1String("ts"), event.timestamp);
+        object.insert(QLatin1String("pid"), pid);
+        object.insert(QLatin1String("tid"), qint64(event.thread));
+
+        switch (event.phase) {
+        case 'X':
+            object.insert(QLatin1String("dur"), event.value);
+            break;
+        case 'C': {
+            QJsonObject args;
+            args.insert(QLatin1String("value"), event.value);
+            object.insert(QLatin1String("args"), args);
+            break;
+        }
+        case 'i':
+            object.insert(QLatin1String("s"), QLatin1String("t"));
+            break;
+        default:
+            break;
+        }
+
+        events.append(object);
+    }
+
+    QJsonObject trace;
+    trace.insert(QLatin1String("traceEvents"), events);
+    trace.insert(QLatin1String("displayTimeUnit"), QLatin1String("ms"));
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+
+    return file.commit();
+}
+
+qint64 Tracer::bufferSize()
+{
+    if (!s_allocated.load(std::memory_order_relaxed))
+        return 0;
+
+    return qint64(s_capacity * sizeof(TraceEvent));
+}
+
+}
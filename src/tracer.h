@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef QAPT_TRACER_H
+#define QAPT_TRACER_H
+
+#include <QString>
+
+#include <atomic>
+
+namespace QApt {
+
+/**
+ * The Tracer class records spans, instants and counters into a fixed-size
+ * ring buffer, which can be exported in the Chrome trace event format
+ * (readable by chrome://tracing and Perfetto).
+ *
+ * Recording is off by default and costs a single relaxed atomic load per
+ * trace point while off. Event names must be string literals, as only the
+ * pointer is stored.
+ *
+ * This class is internal to LibQApt.
+ */
+class Tracer
+{
+public:
+    static bool isEnabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static void setEnabled(bool enabled);
+
+    /// Microseconds since tracing was first enabled
+    static qint64 now();
+
+    /// Records a span named @p name that started at @p start
+    static void complete(const char *name, qint64 start);
+    static void instant(const char *name);
+    static void counter(const char *name, qint64 value);
+
+    /// Discards all recorded events
+    static void clear();
+
+    /**
+     * Writes the recorded events to @p path as Chrome trace JSON
+     *
+     * @return @c true on success
+     */
+    static bool save(const QString &path);
+
+    /// Memory reserved for the ring buffer, in bytes
+    static qint64 bufferSize();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+/**
+ * Records a span covering the lifetime of the object, if tracing is
+ * enabled when it is created.
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name)
+        : m_name(Tracer::isEnabled() ? name : nullptr)
+        , m_start(m_name ? Tracer::now() : 0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (m_name)
+            Tracer::complete(m_name, m_start);
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char *m_name;
+    qint64 m_start;
+};
+
+}
+
+#define QAPT_TRACE_CONCAT_IMPL(a, b) a##b
+#define QAPT_TRACE_CONCAT(a, b) QAPT_TRACE_CONCAT_IMPL(a, b)
+
+#define QAPT_TRACE_SPAN(name) \
+    QApt::TraceSpan QAPT_TRACE_CONCAT(qaptTraceSpan, __LINE__)(name)
+
+#define QAPT_TRACE_INSTANT(name) \
+    do { if (QApt::Tracer::isEnabled()) QApt::Tracer::instant(name); } while (0)
+
+#define QAPT_TRACE_COUNTER(name, value) \
+    do { if (QApt::Tracer::isEnabled()) QApt::Tracer::counter(name, value); } while (0)
+
+#endif
@@ -22,12 +22,16 @@
 
 // Qt includes
 #include <QDBusPendingCallWatcher>
+#include <QDBusUnixFileDescriptor>
 #include <QDBusVariant>
+#include <QHash>
+#include <QVector>
 
 #include <QDebug>
 
 // Own includes
 #include "dbusinterfaces_p.h"
+#include "downloadprogressbatch.h"
 
 namespace QApt {
 
@@ -47,6 +51,7 @@ class TransactionPrivate
             , progress(0)
             , downloadSpeed(0)
             , downloadETA(0)
+            , priority(QApt::InteractivePriority)
         {
             dbus = new TransactionInterface(QLatin1String(s_workerReverseDomainName),
                                             tid, QDBusConnection::systemBus(),
@@ -85,6 +90,13 @@ class TransactionPrivate
         QString filePath;
         QString errorDetails;
         QApt::FrontendCaps frontendCaps;
+        QVariantMap changeManifest;
+        QApt::TransactionPriority priority;
+
+        // URIs and short descriptions of the downloads seen so far, by ID
+        QHash<quint32, QPair<QString, QString> > downloadItems;
+        // The downloads from the last DownloadProgressBatchProperty update
+        QList<DownloadProgress> downloadBatch;
 };
 
 Transaction::Transaction(const QString &tid)
@@ -101,6 +113,8 @@ Transaction::Transaction(const QString &tid)
 
     connect(d->dbus, SIGNAL(propertyChanged(int,QDBusVariant)),
             this, SLOT(updateProperty(int,QDBusVariant)));
+    connect(d->dbus, SIGNAL(propertiesChanged(QApt::PropertyMap)),
+            this, SLOT(updateProperties(QApt::PropertyMap)));
     connect(d->dbus, SIGNAL(mediumRequired(QString,QString)),
             this, SIGNAL(mediumRequired(QString,QString)));
     connect(d->dbus, SIGNAL(promptUntrusted(QStringList)),
@@ -374,10 +388,7 @@ int Transaction::progress() const
 
 void Transaction::updateProgress(int progress)
 {
-    if (d->progress != progress) {
-        d->progress = progress;
-        emit progressChanged(d->progress);
-    }
+    d->progress = progress;
 }
 
 DownloadProgress Transaction::downloadProgress() const
@@ -470,6 +481,36 @@ void Transaction::updateFrontendCaps(FrontendCaps frontendCaps)
     d->frontendCaps = frontendCaps;
 }
 
+QVariantMap Transaction::changeManifest() const
+{
+    return d->changeManifest;
+}
+
+void Transaction::updateChangeManifest(const QVariantMap &manifest)
+{
+    d->changeManifest = manifest;
+}
+
+QApt::TransactionPriority Transaction::priority() const
+{
+    return d->priority;
+}
+
+void Transaction::setPriority(TransactionPriority priority)
+{
+    QDBusPendingCall call = d->dbus->setProperty(QApt::PriorityProperty,
+                                                 QDBusVariant((int)priority));
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+            this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+}
+
+void Transaction::updatePriority(TransactionPriority priority)
+{
+    d->priority = priority;
+}
+
 void Transaction::setProxy(const QString &proxy)
 {
     QDBusPendingCall call = d->dbus->setProperty(QApt::ProxyProperty,
@@ -535,6 +576,15 @@ void Transaction::resolveConfigFileConflict(const QString &currentPath, bool rep
             this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
 }
 
+void Transaction::attachTerminal(int fd)
+{
+    QDBusPendingCall call = d->dbus->attachTerminal(QDBusUnixFileDescriptor(fd));
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+            this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+}
+
 void Transaction::onCallFinished(QDBusPendingCallWatcher *watcher)
 {
     QDBusPendingReply<> reply = *watcher;
@@ -607,7 +657,8 @@ void Transaction::sync()
                 updateError((ErrorCode)iter.value().toInt());
             else if (iter.key() == QLatin1String("exitStatus"))
                 updateExitStatus((ExitStatus)iter.value().toInt());
-            else if (iter.key() == QLatin1String("packages"))
+            else if (iter.key() == QLatin1String("packages") ||
+                     iter.key() == QLatin1String("changeManifest"))
                 // iter.value() for the QVariantMap is QDBusArgument, so we have to
                 // set this manually
                 setProperty(iter.key().toLatin1(), d->dbus->property(iter.key().toLatin1()));
@@ -615,6 +666,8 @@ void Transaction::sync()
                 updateDownloadProgress(iter.value().value<QApt::DownloadProgress>());
             else if (iter.key() == QLatin1String("frontendCaps"))
                 updateFrontendCaps((FrontendCaps)iter.value().toInt());
+            else if (iter.key() == QLatin1String("priority"))
+                updatePriority((TransactionPriority)iter.value().toInt());
             else
                 qDebug() << "failed to set:" << iter.key();
         }
@@ -622,6 +675,27 @@ void Transaction::sync()
 }
 
 void Transaction::updateProperty(int type, const QDBusVariant &variant)
+{
+    if (applyProperty(type, variant))
+        emitPropertyChanged(type);
+}
+
+void Transaction::updateProperties(const QApt::PropertyMap &properties)
+{
+    // Apply the whole batch before telling anyone, so that slots never see
+    // a mix of old and new values
+    QVector<int> changed;
+    changed.reserve(properties.size());
+    for (auto it = properties.constBegin(); it != properties.constEnd(); ++it) {
+        if (applyProperty(it.key(), it.value()))
+            changed.append(it.key());
+    }
+
+    for (int type : changed)
+        emitPropertyChanged(type);
+}
+
+bool Transaction::applyProperty(int type, const QDBusVariant &variant)
 {
     switch (type) {
     case TransactionIdProperty:
@@ -633,11 +707,9 @@ void Transaction::updateProperty(int type, const QDBusVariant &variant)
         break;
     case StatusProperty:
         updateStatus((TransactionStatus)variant.variant().toInt());
-        emit statusChanged(status());
         break;
     case ErrorProperty:
         updateError((ErrorCode)variant.variant().toInt());
-        emit errorOccurred(error());
         break;
     case LocaleProperty:
         updateLocale(variant.variant().toString());
@@ -653,37 +725,33 @@ void Transaction::updateProperty(int type, const QDBusVariant &variant)
         break;
     case CancellableProperty:
         updateCancellable(variant.variant().toBool());
-        emit cancellableChanged(isCancellable());
         break;
     case CancelledProperty:
         updateCancelled(variant.variant().toBool());
         break;
     case ExitStatusProperty:
         updateExitStatus((ExitStatus)variant.variant().toInt());
-        if (exitStatus() != QApt::ExitUnfinished)
-            emit finished(exitStatus());
         break;
     case PausedProperty:
         updatePaused(variant.variant().toBool());
-        if (isPaused())
-            emit paused();
-        else
-            emit resumed();
         break;
     case StatusDetailsProperty:
         updateStatusDetails(variant.variant().toString());
-        emit statusDetailsChanged(statusDetails());
         break;
-    case ProgressProperty:
-        updateProgress(variant.variant().toInt());
+    case ProgressProperty: {
+        const int progress = variant.variant().toInt();
+        if (d->progress == progress)
+            return false;
+
+        updateProgress(progress);
         break;
+    }
     case DownloadProgressProperty: {
         QApt::DownloadProgress prog;
         QDBusArgument arg = variant.variant().value<QDBusArgument>();
         arg >> prog;
 
         updateDownloadProgress(prog);
-        emit downloadProgressChanged(downloadProgress());
         break;
     }
     case UntrustedPackagesProperty:
@@ -691,11 +759,9 @@ void Transaction::updateProperty(int type, const QDBusVariant &variant)
         break;
     case DownloadSpeedProperty:
         updateDownloadSpeed(variant.variant().toULongLong());
-        emit downloadSpeedChanged(downloadSpeed());
         break;
     case DownloadETAProperty:
         updateDownloadETA(variant.variant().toULongLong());
-        emit downloadETAChanged(downloadETA());
         break;
     case FilePathProperty:
         updateFilePath(variant.variant().toString());
@@ -706,6 +772,81 @@ void Transaction::updateProperty(int type, const QDBusVariant &variant)
     case FrontendCapsProperty:
         updateFrontendCaps((FrontendCaps)variant.variant().toInt());
         break;
+    case ChangeManifestProperty:
+        updateChangeManifest(variant.variant().toMap());
+        break;
+    case PriorityProperty:
+        updatePriority((TransactionPriority)variant.variant().toInt());
+        break;
+    case DownloadProgressBatchProperty: {
+        DownloadProgressBatch batch;
+        QDBusArgument arg = variant.variant().value<QDBusArgument>();
+        arg >> batch;
+
+        d->downloadBatch.clear();
+        for (const DownloadProgressRecord &record : batch) {
+            // Only sent when the item starts out or changes status
+            if (!record.uri.isEmpty())
+                d->downloadItems.insert(record.id, qMakePair(record.uri, record.shortDescription));
+
+            const QPair<QString, QString> item = d->downloadItems.value(record.id);
+            d->downloadBatch.append(DownloadProgress(item.first, (DownloadStatus)record.status,
+                                                     item.second, record.fileSize,
+                                                     record.fetchedSize, record.statusMessage));
+        }
+
+        if (!d->downloadBatch.isEmpty())
+            updateDownloadProgress(d->downloadBatch.last());
+        break;
+    }
+    default:
+        break;
+    }
+
+    return true;
+}
+
+void Transaction::emitPropertyChanged(int type)
+{
+    switch (type) {
+    case StatusProperty:
+        emit statusChanged(status());
+        break;
+    case ErrorProperty:
+        emit errorOccurred(error());
+        break;
+    case CancellableProperty:
+        emit cancellableChanged(isCancellable());
+        break;
+    case ExitStatusProperty:
+        if (exitStatus() != QApt::ExitUnfinished)
+            emit finished(exitStatus());
+        break;
+    case PausedProperty:
+        if (isPaused())
+            emit paused();
+        else
+            emit resumed();
+        break;
+    case StatusDetailsProperty:
+        emit statusDetailsChanged(statusDetails());
+        break;
+    case ProgressProperty:
+        emit progressChanged(progress());
+        break;
+    case DownloadProgressProperty:
+        emit downloadProgressChanged(downloadProgress());
+        break;
+    case DownloadSpeedProperty:
+        emit downloadSpeedChanged(downloadSpeed());
+        break;
+    case DownloadETAProperty:
+        emit downloadETAChanged(downloadETA());
+        break;
+    case DownloadProgressBatchProperty:
+        for (const DownloadProgress &progress : d->downloadBatch)
+            emit downloadProgressChanged(progress);
+        break;
     default:
         break;
     }
@@ -86,6 +86,8 @@ class Q_DECL_EXPORT Transaction : public QObject
     Q_PROPERTY(QString filePath READ filePath WRITE updateFilePath)
     Q_PROPERTY(QString errorDetails READ errorDetails WRITE updateErrorDetails)
     Q_PROPERTY(FrontendCaps frontendCaps READ frontendCaps WRITE updateFrontendCaps)
+    Q_PROPERTY(QVariantMap changeManifest READ changeManifest WRITE updateChangeManifest)
+    Q_PROPERTY(TransactionPriority priority READ priority WRITE updatePriority)
 
 public:
     /**
@@ -268,6 +270,33 @@ public:
      */
     QApt::FrontendCaps frontendCaps() const;
 
+    /**
+     * Returns the changes that a successfully finished commit made to the
+     * system, so that clients can update their package states without
+     * reloading the whole cache.
+     *
+     * The keys are package names, with an architecture suffix for foreign
+     * packages. Each value is a QVariantList holding the QApt::Package::State
+     * of the change (NewInstall, ToUpgrade, ToDowngrade, ToReInstall,
+     * ToRemove or ToPurge), the version installed before the change and the
+     * version installed after it. Versions that don't apply are empty.
+     *
+     * The manifest is available by the time finished() is emitted. It is
+     * empty for transactions that failed, that did not commit package
+     * changes, or that installed a .deb file.
+     *
+     * @since 3.1
+     */
+    QVariantMap changeManifest() const;
+
+    /**
+     * Returns the priority of the transaction in the worker's queue.
+     *
+     * @see setPriority
+     * @since 3.1
+     */
+    QApt::TransactionPriority priority() const;
+
 private:
     TransactionPrivate *const d;
 
@@ -293,6 +322,10 @@ private:
     void updateFilePath(const QString &filePath);
     void updateErrorDetails(const QString &errorDetails);
     void updateFrontendCaps(QApt::FrontendCaps frontendCaps);
+    void updateChangeManifest(const QVariantMap &manifest);
+    void updatePriority(QApt::TransactionPriority priority);
+    bool applyProperty(int type, const QDBusVariant &variant);
+    void emitPropertyChanged(int type);
 
 Q_SIGNALS:
     /**
@@ -481,6 +514,25 @@ public Q_SLOTS:
      */
     void setFrontendCaps(QApt::FrontendCaps frontendCaps);
 
+    /**
+     * Sets the priority of the transaction. Waiting transactions are run in
+     * order of priority, and a transaction that needs the package system
+     * can interrupt the archive downloads of a running transaction with a
+     * lower priority. The interrupted transaction goes back in to the queue
+     * and picks up its downloads where it left off when it runs again.
+     *
+     * This property can only be changed before the transaction is run. It
+     * defaults to InteractivePriority. Raising it above InteractivePriority
+     * needs administrator authorization, and fails with an AuthError
+     * otherwise.
+     *
+     * @param priority The priority of the transaction
+     *
+     * @see priority
+     * @since 3.1
+     */
+    void setPriority(QApt::TransactionPriority priority);
+
     /**
      * Queues the transaction to be processed by the QApt Worker.
      */
@@ -525,9 +577,27 @@ public Q_SLOTS:
      */
     void resolveConfigFileConflict(const QString &currentPath, bool replace);
 
+    /**
+     * Asks the QApt Worker to copy the raw terminal output of dpkg to
+     * @p fd, for frontends that want to show a console to power users.
+     *
+     * @p fd must be a connected stream socket, such as one end of a
+     * socketpair(). The worker never waits on it: output that doesn't fit
+     * in the socket's buffer is dropped, so a slow reader can't hold up the
+     * installation. Only the user owning the transaction may attach a
+     * terminal.
+     *
+     * @param fd The socket to write dpkg's output to. The caller keeps
+     * ownership of it.
+     *
+     * @since 3.1
+     */
+    void attachTerminal(int fd);
+
 private Q_SLOTS:
     void sync();
     void updateProperty(int type, const QDBusVariant &variant);
+    void updateProperties(const QApt::PropertyMap &properties);
     void onCallFinished(QDBusPendingCallWatcher *watcher);
     void serviceOwnerChanged(QString name, QString oldOwner, QString newOwner);
     void emitFinished(int exitStatus);
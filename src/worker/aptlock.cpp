@@ -23,6 +23,10 @@
 #include <apt-pkg/error.h>
 #include <QDebug>
 
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
 AptLock::AptLock(const QString &path)
     : m_path(path.toUtf8())
     , m_fd(-1)
@@ -55,3 +59,43 @@ void AptLock::release()
     ::close(m_fd);
     m_fd = -1;
 }
+
+bool AptLock::wait(int timeout)
+{
+    if (isLocked())
+        return true;
+
+    const QByteArray lockFile = m_path + "lock";
+
+    // Locks go away when their holder closes the file or exits, and there
+    // are no events for the fcntl lock itself
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, lockFile.constData(),
+                                    IN_CLOSE_WRITE | IN_CLOSE_NOWRITE | IN_DELETE_SELF) < 0) {
+        if (fd >= 0)
+            ::close(fd);
+
+        // Fall back on just waiting it out
+        usleep(timeout * 1000);
+        return acquire();
+    }
+
+    // Checked once the watch is in place, so a release in between isn't
+    // missed. A failed attempt closes the file itself, so its event has to
+    // be dropped before waiting.
+    if (!acquire()) {
+        char events[4096];
+        while (read(fd, events, sizeof(events)) > 0);
+
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, timeout);
+
+        acquire();
+    }
+
+    ::close(fd);
+
+    return isLocked();
+}
@@ -34,6 +34,14 @@ public:
     bool acquire();
     void release();
 
+    /**
+     * Waits for up to @p timeout milliseconds for the lock file to be
+     * closed by whoever holds it, then tries to take the lock again.
+     *
+     * @return whether the lock was taken
+     */
+    bool wait(int timeout);
+
 private:
     QByteArray m_path;
     int m_fd;
@@ -23,10 +23,16 @@
 // Qt includes
 #include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QScopedPointer>
+#include <QSet>
 #include <QStringBuilder>
 #include <QStringList>
 #include <QThread>
+#include <QTimer>
 #include <QDebug>
 
 // Apt-pkg includes
@@ -42,9 +48,18 @@
 #include <apt-pkg/update.h>
 #include <apt-pkg/upgrade.h>
 #include <apt-pkg/versionmatch.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 
 // System includes
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <dirent.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/statfs.h>
 #define RAMFS_MAGIC     0x858458f6
@@ -113,13 +128,341 @@ private:
     int m_lastProgress;
 };
 
-AptWorker::AptWorker(QObject *parent)
+class PrefetchAcquire : public pkgAcquireStatus
+{
+public:
+    /**
+     * @param downloadLimit The average download rate to keep to, in bytes
+     * per second, or 0 for none
+     */
+    explicit PrefetchAcquire(Transaction *trans, double downloadLimit = 0)
+        : m_trans(trans)
+        , m_downloadLimit(downloadLimit)
+        , m_transferred(0)
+        , m_lastPulse(0)
+        , m_throttled(false)
+    {
+        m_timer.start();
+    }
+
+    /// Call right before running a fetch with this status
+    void holdEnvironment()
+    {
+        m_environment.hold(m_trans->proxy());
+    }
+
+    void Start()
+    {
+        pkgAcquireStatus::Start();
+
+        m_lastPulse = m_timer.elapsed();
+        m_throttled = false;
+    }
+
+    void Stop()
+    {
+        pkgAcquireStatus::Stop();
+
+        // No more methods will be started for this fetch
+        m_environment.release();
+    }
+
+    bool MediaChange(std::string Media, std::string Drive)
+    {
+        Q_UNUSED(Media);
+        Q_UNUSED(Drive);
+
+        // Media are for the transaction to ask for when it runs
+        return false;
+    }
+
+    bool Pulse(pkgAcquire *Owner)
+    {
+        pkgAcquireStatus::Pulse(Owner);
+
+        if (m_trans->isCancelled() || m_trans->isPreemptionRequested())
+            return false;
+
+        if (m_downloadLimit <= 0)
+            return true;
+
+        const qint64 now = m_timer.elapsed();
+        m_transferred += CurrentCPS * (now - m_lastPulse) / 1000.0;
+        m_lastPulse = now;
+
+        // Allow for a second's worth of burst before stopping the fetch
+        if (m_transferred > m_downloadLimit * (now / 1000.0 + 1)) {
+            m_throttled = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Waits until the average rate is back under the limit, after the fetch
+     * was stopped for going over it. Cancelling the transaction or asking
+     * it to give way ends the wait right away.
+     *
+     * @return @c true if the fetch should be started again
+     */
+    bool waitForLimit()
+    {
+        if (!m_throttled)
+            return false;
+
+        while (true) {
+            const double excess = m_transferred - m_downloadLimit * m_timer.elapsed() / 1000.0;
+            if (excess <= 0)
+                return true;
+
+            // As long as it takes for the average to come back down
+            if (m_trans->waitForInterruption(excess * 1000 / m_downloadLimit + 1))
+                return false;
+        }
+    }
+
+private:
+    Transaction *m_trans;
+    double m_downloadLimit;
+    double m_transferred;
+    QElapsedTimer m_timer;
+    qint64 m_lastPulse;
+    bool m_throttled;
+    MethodEnvironment m_environment;
+};
+
+struct CommitBatch
+{
+    enum Action {
+        Install,
+        Remove,
+        Purge,
+        ReInstall
+    };
+
+    // Batches after the first are marked on caches built once the ones
+    // before them are installed, so packages are referred to by name
+    struct Change {
+        std::string package;
+        std::string version;
+        Action action;
+        bool automatic;
+    };
+
+    QVector<Change> changes;
+    double downloadSize = 0;
+};
+
+namespace {
+
+bool markBatch(pkgDepCache &cache, const CommitBatch &batch)
+{
+    {
+        pkgDepCache::ActionGroup group(cache);
+
+        for (const CommitBatch::Change &change : batch.changes) {
+            pkgCache::PkgIterator pkg = cache.FindPkg(change.package);
+            if (pkg.end())
+                return false;
+
+            switch (change.action) {
+            case CommitBatch::Install: {
+                pkgCache::VerIterator ver = pkg.VersionList();
+                while (!ver.end() && change.version != ver.VerStr())
+                    ++ver;
+
+                if (ver.end())
+                    return false;
+
+                cache.SetCandidateVersion(ver);
+                cache.MarkInstall(pkg, false, 0, !change.automatic);
+                cache.MarkAuto(pkg, change.automatic);
+                break;
+            }
+            case CommitBatch::Remove:
+            case CommitBatch::Purge:
+                cache.MarkDelete(pkg, change.action == CommitBatch::Purge);
+                break;
+            case CommitBatch::ReInstall:
+                cache.SetReInstall(pkg, true);
+                break;
+            }
+        }
+    }
+
+    return cache.BrokenCount() == 0;
+}
+
+}
+
+/**
+ * Downloads the archives of one batch of a streaming commit in the
+ * background, with package states of its own so that the batch before it
+ * can be installed meanwhile. Progress is reported to the transaction as
+ * for any other fetch, within the given range.
+ */
+class BatchFetch : public QThread
+{
+public:
+    BatchFetch(pkgCacheFile *cacheFile, Transaction *trans, int begin, int end)
+        : m_cache(cacheFile->GetPkgCache(), cacheFile->GetPolicy())
+        , m_acquire(nullptr, begin, end)
+        , m_fetcher(&m_acquire)
+        , m_result(pkgAcquire::Continue)
+    {
+        m_acquire.setTransaction(trans);
+    }
+
+    ~BatchFetch()
+    {
+        m_acquire.stop();
+        wait();
+    }
+
+    /**
+     * Marks @p batches in order and queues the archives they need. Those
+     * already in the archive cache aren't fetched again.
+     */
+    bool prepare(const QVector<CommitBatch> &batches, pkgSourceList *sources, pkgRecords *records)
+    {
+        if (!m_cache.Init(nullptr))
+            return false;
+
+        for (const CommitBatch &batch : batches) {
+            if (!markBatch(m_cache, batch))
+                return false;
+        }
+
+        m_packageManager.reset(_system->CreatePM(&m_cache));
+
+        return m_packageManager->GetArchives(&m_fetcher, sources, records) &&
+               !_error->PendingError();
+    }
+
+    /// Whether every archive was already in the archive cache
+    bool hasArchives()
+    {
+        for (auto i = m_fetcher.ItemsBegin(); i != m_fetcher.ItemsEnd(); ++i) {
+            if ((*i)->Status != pkgAcquire::Item::StatDone || !(*i)->Complete)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool succeeded()
+    {
+        if (m_result != pkgAcquire::Continue)
+            return false;
+
+        for (auto i = m_fetcher.ItemsBegin(); i != m_fetcher.ItemsEnd(); ++i) {
+            if ((*i)->Status == pkgAcquire::Item::StatDone && (*i)->Complete)
+                continue;
+            if ((*i)->Status == pkgAcquire::Item::StatIdle)
+                continue;
+
+            return false;
+        }
+
+        return true;
+    }
+
+    bool isPreempted() const
+    {
+        return m_acquire.isPreempted();
+    }
+
+    pkgPackageManager *packageManager() const
+    {
+        return m_packageManager.data();
+    }
+
+protected:
+    void run()
+    {
+        m_acquire.holdEnvironment();
+        m_result = m_fetcher.Run();
+    }
+
+private:
+    pkgDepCache m_cache;
+    WorkerAcquire m_acquire;
+    pkgAcquire m_fetcher;
+    QScopedPointer<pkgPackageManager> m_packageManager;
+    pkgAcquire::RunResult m_result;
+};
+
+namespace {
+
+void addFileStamp(QByteArray &stamp, const std::string &path)
+{
+    struct stat info;
+    if (path.empty() || stat(path.c_str(), &info) != 0) {
+        stamp += "-;";
+        return;
+    }
+
+    // Directories get a new mtime when files are added, removed or
+    // renamed into place, which is how APT replaces lists
+    stamp += QByteArray::number(qulonglong(info.st_ino)) + ':' +
+             QByteArray::number(qlonglong(info.st_size)) + ':' +
+             QByteArray::number(qlonglong(info.st_mtim.tv_sec)) + '.' +
+             QByteArray::number(qlonglong(info.st_mtim.tv_nsec)) + ';';
+}
+
+void addDirectoryStamp(QByteArray &stamp, const std::string &path)
+{
+    addFileStamp(stamp, path);
+
+    // Files rewritten in place leave the directory's own mtime alone, so
+    // also take the newest of its entries
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return;
+
+    struct timespec newest = { 0, 0 };
+    while (struct dirent *entry = readdir(dir)) {
+        struct stat info;
+        if (entry->d_name[0] == '.' || fstatat(dirfd(dir), entry->d_name, &info, 0) != 0)
+            continue;
+
+        if (info.st_mtim.tv_sec > newest.tv_sec ||
+            (info.st_mtim.tv_sec == newest.tv_sec && info.st_mtim.tv_nsec > newest.tv_nsec))
+            newest = info.st_mtim;
+    }
+    closedir(dir);
+
+    stamp += QByteArray::number(qlonglong(newest.tv_sec)) + '.' +
+             QByteArray::number(qlonglong(newest.tv_nsec)) + ';';
+}
+
+void releaseFreeMemory()
+{
+#ifdef __GLIBC__
+    // Hand what the old cache and the transaction freed back to the system,
+    // rather than keeping it in the heap while idling
+    malloc_trim(0);
+#endif
+}
+
+std::once_flag s_systemInit;
+
+}
+
+AptWorker::AptWorker(QObject *parent, bool primary)
     : QObject(parent)
+    , m_primary(primary)
     , m_cache(nullptr)
     , m_records(nullptr)
     , m_trans(nullptr)
+    , m_dpkgProcess(nullptr)
+    , m_preempted(false)
     , m_ready(false)
     , m_lastActiveTimestamp(QDateTime::currentMSecsSinceEpoch())
+    , m_standbyTimeout(0)
+    , m_cacheWatcher(nullptr)
+    , m_refreshTimer(nullptr)
 {
 }
 
@@ -135,6 +478,24 @@ void AptWorker::quit()
     thread()->quit();
 }
 
+int AptWorker::locksForRole(QApt::TransactionRole role)
+{
+    switch (role) {
+    case QApt::UpdateCacheRole:
+        return ListsLock;
+    case QApt::CommitChangesRole:
+    case QApt::UpgradeSystemRole:
+        return ArchivesLock | StatusLock;
+    case QApt::InstallFileRole:
+        return StatusLock;
+    // Archives are downloaded to a directory of the user's choosing
+    case QApt::DownloadArchivesRole:
+    case QApt::EmptyRole:
+    default:
+        return NoLocks;
+    }
+}
+
 Transaction *AptWorker::currentTransaction()
 {
     QMutexLocker locker(&m_transMutex);
@@ -143,20 +504,30 @@ Transaction *AptWorker::currentTransaction()
 
 quint64 AptWorker::lastActiveTimestamp()
 {
-    QMutexLocker locker(&m_timestampMutex);
+    QMutexLocker locker(&m_transMutex);
     return m_lastActiveTimestamp;
 }
 
+int AptWorker::standbyTimeout()
+{
+    QMutexLocker locker(&m_standbyMutex);
+    return m_standbyTimeout;
+}
+
 void AptWorker::init()
 {
     if (m_ready)
         return;
 
-    pkgInitConfig(*_config);
-    pkgInitSystem(*_config, _system);
+    // The configuration and system are global to the process, and shared
+    // with any other worker contexts
+    std::call_once(s_systemInit, []() {
+        pkgInitConfig(*_config);
+        pkgInitSystem(*_config, _system);
+    });
     m_cache = new pkgCacheFile;
 
-    // Prepare locks to be used later
+    // Prepare locks to be used later, in the order of the Lock flags
     QStringList dirs;
 
     dirs << QString::fromStdString(_config->FindDir("Dir::Cache::Archives"))
@@ -170,6 +541,33 @@ void AptWorker::init()
         m_locks << new AptLock(dir);
     }
 
+    m_standbyMutex.lock();
+    m_standbyTimeout = m_primary ? _config->FindI("QApt::Worker::StandbyTimeout", 0) : 0;
+    m_standbyMutex.unlock();
+
+    if (m_standbyTimeout) {
+        // Have the cache ready before the first transaction asks for it,
+        // and keep it current while waiting for the next ones
+        if (!loadCache(nullptr))
+            _error->Discard();
+
+        m_refreshTimer = new QTimer(this);
+        m_refreshTimer->setSingleShot(true);
+        // dpkg rewrites its status many times over a run, so wait for it
+        // to settle down
+        m_refreshTimer->setInterval(5000);
+        connect(m_refreshTimer, SIGNAL(timeout()), this, SLOT(refreshCache()));
+
+        m_cacheWatcher = new QFileSystemWatcher(this);
+        connect(m_cacheWatcher, SIGNAL(fileChanged(QString)),
+                this, SLOT(scheduleCacheRefresh()));
+        connect(m_cacheWatcher, SIGNAL(directoryChanged(QString)),
+                this, SLOT(scheduleCacheRefresh()));
+        watchCacheSources();
+
+        releaseFreeMemory();
+    }
+
     m_ready = true;
 }
 
@@ -179,10 +577,11 @@ void AptWorker::runTransaction(Transaction *trans)
     if (m_trans || !m_ready)
         return;
 
-    m_timestampMutex.lock();
+    m_transMutex.lock();
     m_lastActiveTimestamp = QDateTime::currentMSecsSinceEpoch();
-    m_timestampMutex.unlock();
     m_trans = trans;
+    m_transMutex.unlock();
+    m_merged = trans->mergedTransactions();
     trans->setStatus(QApt::RunningStatus);
     waitForLocks();
     openCache();
@@ -204,12 +603,21 @@ void AptWorker::runTransaction(Transaction *trans)
         upgradeSystem();
         break;
     case QApt::CommitChangesRole:
-        if (markChanges())
+        if (m_merged.isEmpty()) {
+            if (markChanges())
+                commitChanges();
+        } else if (markMergedChanges()) {
             commitChanges();
+        } else {
+            runMergedSeparately();
+            return;
+        }
         break;
     case QApt::InstallFileRole:
         installFile();
-        m_dpkgProcess->waitForFinished(-1);
+        // Not started if the file was rejected or dpkg failed to run
+        if (m_dpkgProcess)
+            m_dpkgProcess->waitForFinished(-1);
         break;
     case QApt::DownloadArchivesRole:
         downloadArchives();
@@ -220,10 +628,51 @@ void AptWorker::runTransaction(Transaction *trans)
         break;
     }
 
+    // Make way for a transaction with a higher priority
+    if (m_preempted) {
+        requeueCurrentTransaction();
+        return;
+    }
+
     // Cleanup
     cleanupCurrentTransaction();
 }
 
+void AptWorker::requeueCurrentTransaction()
+{
+    for (AptLock *lock : m_locks) {
+        lock->release();
+    }
+
+    QList<Transaction *> transactions = m_merged;
+    transactions.prepend(m_trans);
+
+    m_trans->setMergedTransactions(QList<Transaction *>());
+    m_merged.clear();
+    m_transMutex.lock();
+    m_trans = nullptr;
+    m_transMutex.unlock();
+    m_preempted = false;
+
+    for (Transaction *trans : transactions)
+        returnToQueue(trans);
+
+    QMutexLocker locker(&m_transMutex);
+    m_lastActiveTimestamp = QDateTime::currentMSecsSinceEpoch();
+}
+
+void AptWorker::returnToQueue(Transaction *trans)
+{
+    // The transaction starts over when it runs again, with the archives
+    // that were already fetched left in the archive cache
+    trans->setPreemptionRequested(false);
+    trans->setErrorDetails(QString());
+    trans->setProgress(0);
+    trans->setCancellable(true);
+    trans->setStatus(QApt::WaitingStatus);
+    emit transactionPreempted(trans);
+}
+
 void AptWorker::cleanupCurrentTransaction()
 {
     // Well, we're finished now.
@@ -237,22 +686,57 @@ void AptWorker::cleanupCurrentTransaction()
     // Set transaction exit status
     // This will notify the transaction queue of the transaction's completion
     // as well as mark the transaction for deletion in 5 seconds
+    QApt::ExitStatus exitStatus = QApt::ExitSuccess;
     if (m_trans->isCancelled())
-        m_trans->setExitStatus(QApt::ExitCancelled);
+        exitStatus = QApt::ExitCancelled;
     else if (m_trans->error() != QApt::Success)
-        m_trans->setExitStatus(QApt::ExitFailed);
-    else
-        m_trans->setExitStatus(QApt::ExitSuccess);
+        exitStatus = QApt::ExitFailed;
+
+    // Merged transactions share the download and dpkg run, so they take on
+    // its outcome unless they already failed on their own
+    for (Transaction *merged : m_merged) {
+        merged->setProgress(100);
+        if (merged->error() == QApt::Success && m_trans->error() != QApt::Success) {
+            merged->setError((QApt::ErrorCode)m_trans->error());
+            merged->setErrorDetails(m_trans->errorDetails());
+        }
 
-    m_trans = nullptr;
+        QApt::ExitStatus mergedStatus = QApt::ExitSuccess;
+        if (m_trans->isCancelled() || merged->isCancelled())
+            mergedStatus = QApt::ExitCancelled;
+        else if (merged->error() != QApt::Success)
+            mergedStatus = QApt::ExitFailed;
+        else
+            merged->setChangeManifest(m_trans->changeManifest());
 
-    QMutexLocker locker(&m_timestampMutex);
+        merged->setExitStatus(mergedStatus);
+    }
+
+    m_trans->setMergedTransactions(QList<Transaction *>());
+    m_merged.clear();
+
+    m_trans->setExitStatus(exitStatus);
+
+    if (m_standbyTimeout)
+        releaseFreeMemory();
+
+    QMutexLocker locker(&m_transMutex);
+    m_trans = nullptr;
     m_lastActiveTimestamp = QDateTime::currentMSecsSinceEpoch();
 }
 
 void AptWorker::waitForLocks()
 {
-    for (AptLock *lock : m_locks) {
+    const int locks = locksForRole((QApt::TransactionRole)m_trans->role());
+
+    for (int i = 0; i < m_locks.size(); ++i) {
+        AptLock *lock = m_locks.at(i);
+
+        // Locks are per process, so they only keep out other programs. The
+        // transaction queue keeps our own transactions from overlapping.
+        if (!(locks & (1 << i)))
+            continue;
+
         if (lock->acquire()) {
             qDebug() << "locked?" << lock->isLocked();
             continue;
@@ -263,9 +747,9 @@ void AptWorker::waitForLocks()
         m_trans->setStatus(QApt::WaitingLockStatus);
 
         while (!lock->isLocked() && m_trans->isPaused() && !m_trans->isCancelled()) {
-            // Wait 3 seconds and try again
-            sleep(3);
-            lock->acquire();
+            // Wait for the holder to let go, looking in on the transaction
+            // every few seconds in case it was cancelled
+            lock->wait(3000);
         }
 
         m_trans->setIsPaused(false);
@@ -277,10 +761,7 @@ void AptWorker::openCache(int begin, int end)
     m_trans->setStatus(QApt::LoadingCacheStatus);
     CacheOpenProgress *progress = new CacheOpenProgress(m_trans, begin, end);
 
-    // Close in case it's already open
-    m_cache->Close();
-    _error->Discard();
-    if (!m_cache->ReadOnlyOpen(progress)) {
+    if (!loadCache(progress)) {
         std::string message;
         bool isError = _error->PopMessage(message);
         if (isError)
@@ -294,8 +775,92 @@ void AptWorker::openCache(int begin, int end)
     }
 
     delete progress;
+}
+
+bool AptWorker::loadCache(OpProgress *progress)
+{
+    // Keep the cache from the previous transaction if it is still current,
+    // only dropping the marks that were made on it
+    if (m_records && !m_cacheStamp.isEmpty() && cacheStamp() == m_cacheStamp) {
+        _error->Discard();
+        if (m_cache->GetDepCache()->Init(progress))
+            return true;
+    }
+
+    m_cacheStamp.clear();
+
+    // Close in case it's already open
+    m_cache->Close();
+    _error->Discard();
+    if (!m_cache->ReadOnlyOpen(progress))
+        return false;
+
     delete m_records;
     m_records = new pkgRecords(*(m_cache));
+
+    // Taken after opening, since that may have rewritten pkgcache.bin
+    m_cacheStamp = cacheStamp();
+
+    return true;
+}
+
+void AptWorker::watchCacheSources()
+{
+    QStringList paths;
+    paths << QString::fromStdString(_config->FindFile("Dir::State::status"))
+          << QString::fromStdString(_config->FindFile("Dir::State::extended_states"))
+          << QString::fromStdString(_config->FindDir("Dir::State::lists"))
+          << QString::fromStdString(_config->FindFile("Dir::Etc::sourcelist"))
+          << QString::fromStdString(_config->FindDir("Dir::Etc::sourceparts"))
+          << QString::fromStdString(_config->FindFile("Dir::Etc::preferences"))
+          << QString::fromStdString(_config->FindDir("Dir::Etc::preferencesparts"))
+          << QString::fromStdString(_config->FindFile("Dir::Etc::main"))
+          << QString::fromStdString(_config->FindDir("Dir::Etc::parts"));
+
+    // Files replaced by rename drop out of the watcher, so this is redone
+    // after every change
+    const QStringList watched = m_cacheWatcher->files() + m_cacheWatcher->directories();
+    for (const QString &path : paths) {
+        if (!watched.contains(path) && QFileInfo::exists(path))
+            m_cacheWatcher->addPath(path);
+    }
+}
+
+void AptWorker::scheduleCacheRefresh()
+{
+    m_refreshTimer->start();
+}
+
+void AptWorker::refreshCache()
+{
+    watchCacheSources();
+
+    // Transactions run on this thread too, so there is never one in
+    // progress here. Ones that just finished already left a current cache.
+    if (!m_records || cacheStamp() != m_cacheStamp) {
+        if (!loadCache(nullptr))
+            _error->Discard();
+
+        releaseFreeMemory();
+    }
+}
+
+QByteArray AptWorker::cacheStamp() const
+{
+    QByteArray stamp;
+
+    addFileStamp(stamp, _config->FindFile("Dir::Cache::pkgcache"));
+    addFileStamp(stamp, _config->FindFile("Dir::State::status"));
+    addFileStamp(stamp, _config->FindFile("Dir::State::extended_states"));
+    addDirectoryStamp(stamp, _config->FindDir("Dir::State::lists"));
+    addFileStamp(stamp, _config->FindFile("Dir::Etc::sourcelist"));
+    addDirectoryStamp(stamp, _config->FindDir("Dir::Etc::sourceparts"));
+    addFileStamp(stamp, _config->FindFile("Dir::Etc::preferences"));
+    addDirectoryStamp(stamp, _config->FindDir("Dir::Etc::preferencesparts"));
+    addFileStamp(stamp, _config->FindFile("Dir::Etc::main"));
+    addDirectoryStamp(stamp, _config->FindDir("Dir::Etc::parts"));
+
+    return stamp;
 }
 
 void AptWorker::updateCache()
@@ -307,6 +872,7 @@ void AptWorker::updateCache()
     pkgAcquire fetcher(acquire);
 
     // Fetch the lists.
+    acquire->holdEnvironment();
     if (!ListUpdate(*acquire, *m_cache->GetSourceList())) {
         if (!m_trans->isCancelled()) {
             m_trans->setError(QApt::FetchError);
@@ -325,13 +891,101 @@ void AptWorker::updateCache()
 }
 
 bool AptWorker::markChanges()
+{
+    QApt::ErrorCode error = QApt::Success;
+    QString details;
+
+    if (!markPackages(m_trans->packages(), error, details)) {
+        m_trans->setError(error);
+        m_trans->setErrorDetails(details);
+        return false;
+    }
+
+    return true;
+}
+
+bool AptWorker::markMergedChanges()
+{
+    // The queue only merges transactions that act on different packages,
+    // so their changes can go in to the same resolver run
+    QVariantMap packages = m_trans->packages();
+    for (Transaction *merged : m_merged) {
+        const QVariantMap mergedPackages = merged->packages();
+        for (auto it = mergedPackages.constBegin(); it != mergedPackages.constEnd(); ++it)
+            packages.insert(it.key(), it.value());
+    }
+
+    QApt::ErrorCode error = QApt::Success;
+    QString details;
+
+    if (markPackages(packages, error, details))
+        return true;
+
+    // A package that can't be found is down to the transaction that asked
+    // for it, which would fail the same way on its own. The others, this
+    // one included, are run separately and get their own errors then.
+    if (error == QApt::NotFoundError) {
+        const QList<Transaction *> merged = m_merged;
+        for (Transaction *trans : merged) {
+            if (!trans->packages().contains(details))
+                continue;
+
+            m_merged.removeOne(trans);
+            m_trans->setMergedTransactions(m_merged);
+
+            trans->setError(error);
+            trans->setErrorDetails(details);
+            trans->setProgress(100);
+            trans->setExitStatus(QApt::ExitFailed);
+            break;
+        }
+    }
+
+    return false;
+}
+
+void AptWorker::runMergedSeparately()
+{
+    const QList<Transaction *> merged = m_merged;
+
+    m_trans->setMergedTransactions(QList<Transaction *>());
+    m_trans->setMergeable(false);
+    m_merged.clear();
+
+    // The rest go back to where they were in the queue, ahead of anything
+    // enqueued since, and run one by one once this one is done
+    for (Transaction *next : merged) {
+        next->setMergeable(false);
+        returnToQueue(next);
+    }
+
+    // Start over from a clean cache, so that the first transaction gets
+    // its own errors
+    openCache();
+    if (m_trans->error() == QApt::Success && markChanges())
+        commitChanges();
+
+    if (m_preempted) {
+        requeueCurrentTransaction();
+        return;
+    }
+
+    cleanupCurrentTransaction();
+}
+
+bool AptWorker::markPackages(const QVariantMap &packages, QApt::ErrorCode &error,
+                             QString &details)
 {
     pkgDepCache::ActionGroup *actionGroup = new pkgDepCache::ActionGroup(*m_cache);
 
-    auto mapIter = m_trans->packages().constBegin();
+    // A single resolver collects the hints for every package in the
+    // transaction, and is run once they have all been marked
+    pkgProblemResolver resolver(*m_cache);
+
+    auto mapIter = packages.constBegin();
 
     QApt::Package::State operation = QApt::Package::ToKeep;
-    while (mapIter != m_trans->packages().constEnd()) {
+    while (mapIter != packages.constEnd()) {
         operation = (QApt::Package::State)mapIter.value().toInt();
 
         // Find package in cache
@@ -350,15 +1004,14 @@ bool AptWorker::markChanges()
 
         // Check if the package was found
         if (iter == 0) {
-            m_trans->setError(QApt::NotFoundError);
-            m_trans->setErrorDetails(packageString);
+            error = QApt::NotFoundError;
+            details = packageString;
 
             delete actionGroup;
             return false;
         }
 
         pkgDepCache::StateCache &State = (*m_cache)[iter];
-        pkgProblemResolver resolver(*m_cache);
         bool toPurge = false;
 
         // Then mark according to the instruction
@@ -406,12 +1059,16 @@ bool AptWorker::markChanges()
             resolver.Clear(iter);
             resolver.Protect(iter);
             resolver.Remove(iter);
+            break;
         default:
             break;
         }
         mapIter++;
     }
 
+    if ((*m_cache)->BrokenCount() > 0)
+        resolver.Resolve(true);
+
     delete actionGroup;
 
     if (_error->PendingError() && ((*m_cache)->BrokenCount() == 0))
@@ -420,12 +1077,95 @@ bool AptWorker::markChanges()
     if (_error->PendingError())
     {
         // We've failed to mark the packages
-        m_trans->setError(QApt::MarkingError);
+        error = QApt::MarkingError;
         std::string message;
         if (_error->PopMessage(message))
-            m_trans->setErrorDetails(QString::fromStdString(message));
+            details = QString::fromStdString(message);
+
+        return false;
+    }
+
+    return true;
+}
+
+void AptWorker::prefetchArchives(Transaction *trans)
+{
+    if (m_ready && !m_trans && !trans->isCancelled() &&
+        _config->FindB("QApt::Worker::Prefetch", true)) {
+        fetchAhead(trans);
+    }
+
+    // Whatever went wrong is for the transaction to find out when it runs
+    _error->Discard();
+
+    emit archivesPrefetched(trans);
+}
+
+void AptWorker::fetchAhead(Transaction *trans)
+{
+    if (!loadCache(nullptr))
+        return;
+
+    // This marks against the system as it is before the running
+    // transaction is done with it, so it may fetch a little more or less
+    // than the transaction will need in the end
+    if (trans->role() == QApt::UpgradeSystemRole) {
+        if (trans->safeUpgrade())
+            APT::Upgrade::Upgrade(*m_cache, APT::Upgrade::FORBID_REMOVE_PACKAGES | APT::Upgrade::FORBID_INSTALL_NEW_PACKAGES);
+        else
+            APT::Upgrade::Upgrade(*m_cache, APT::Upgrade::ALLOW_EVERYTHING);
+    } else {
+        QApt::ErrorCode error = QApt::Success;
+        QString details;
+        if (!markPackages(trans->packages(), error, details))
+            return;
+    }
 
+    // Dl-Limit can only be handed to the download methods through the
+    // global configuration, which would slow down every other fetch too.
+    // Instead the fetch is stopped whenever it gets ahead of the limit, and
+    // started again once it is back under, resuming the partial files.
+    const double downloadLimit = _config->FindI("QApt::Worker::Prefetch::DownloadLimit", 0) * 1024.0;
+    PrefetchAcquire acquire(trans, downloadLimit);
+
+    for (bool first = true; ; first = false) {
+        pkgAcquire fetcher(&acquire);
+
+        QScopedPointer<pkgPackageManager> packageManager(_system->CreatePM(*m_cache));
+        if (!packageManager->GetArchives(&fetcher, m_cache->GetSourceList(), m_records) ||
+            _error->PendingError()) {
+            return;
+        }
+
+        if (first && !canFetchAhead(fetcher))
+            return;
+
+        acquire.holdEnvironment();
+        if (fetcher.Run() == pkgAcquire::Continue || !acquire.waitForLimit())
+            return;
+    }
+}
+
+bool AptWorker::canFetchAhead(pkgAcquire &fetcher) const
+{
+    // Stay under the disk cap, and leave room for the running transaction
+    // to unpack what it fetched
+    const double needed = fetcher.FetchNeeded() - fetcher.PartialPresent();
+    const double maxSize = _config->FindI("QApt::Worker::Prefetch::MaxSize", 1024) * 1048576.0;
+    if (needed <= 0 || (maxSize > 0 && needed > maxSize))
         return false;
+
+    struct statvfs Buf;
+    std::string OutputDir = _config->FindDir("Dir::Cache::Archives");
+    if (statvfs(OutputDir.c_str(), &Buf) != 0 ||
+        double(Buf.f_bavail) * Buf.f_bsize < 2 * needed) {
+        return false;
+    }
+
+    // Untrusted archives have to wait for the transaction to ask about them
+    for (auto it = fetcher.ItemsBegin(); it < fetcher.ItemsEnd(); ++it) {
+        if (!(*it)->IsTrusted())
+            return false;
     }
 
     return true;
@@ -504,8 +1244,7 @@ void AptWorker::commitChanges()
             m_trans->setUntrustedPackages(untrustedPackages, allowUntrusted);
 
             // Wait until the user approves, disapproves, or cancels the transaction
-            while (m_trans->isPaused())
-                 usleep(200000);
+            m_trans->waitWhilePaused();
         }
 
         if (!m_trans->allowUntrusted()) {
@@ -516,11 +1255,33 @@ void AptWorker::commitChanges()
         }
     }
 
+    // In streaming mode, parts of the commit that can be installed on their
+    // own are handed to dpkg while later ones are still downloading
+    if (_config->FindB("QApt::Worker::StreamingCommit", false)) {
+        const QVector<CommitBatch> batches = commitBatches();
+
+        if (batches.size() > 1) {
+            delete acquire;
+
+            // Taken before the commit, which leaves the marks behind it stale
+            const QVariantMap manifest = changeManifest();
+
+            if (commitInBatches(batches))
+                m_trans->setChangeManifest(manifest);
+
+            openCache(91, 95);
+            return;
+        }
+    }
+
     // Fetch archives from the network
+    acquire->holdEnvironment();
     if (fetcher.Run() != pkgAcquire::Continue) {
         // Our fetcher will report warnings for itself, but if it fails entirely
         // we have to send the error and finished signals
-        if (!m_trans->isCancelled()) {
+        if (acquire->isPreempted()) {
+            m_preempted = true;
+        } else if (!m_trans->isCancelled()) {
             m_trans->setError(QApt::FetchError);
         }
 
@@ -550,10 +1311,14 @@ void AptWorker::commitChanges()
         return;
     }
 
+    emit archivesFetched(m_trans);
+
+    // Taken before the commit, which leaves the marks behind it stale
+    const QVariantMap manifest = changeManifest();
+
     // Set up the install
     WorkerInstallProgress installProgress(50, 90);
     installProgress.setTransaction(m_trans);
-    setenv("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", 1);
 
     pkgPackageManager::OrderResult res = installProgress.start(packageManager);
     bool success = (res == pkgPackageManager::Completed);
@@ -562,11 +1327,339 @@ void AptWorker::commitChanges()
     if (!success) {
         m_trans->setError(QApt::CommitError);
         // Error details set by WorkerInstallProgress
+    } else {
+        // Published ahead of the exit status, so that clients have it by
+        // the time they see the transaction finish
+        m_trans->setChangeManifest(manifest);
     }
 
     openCache(91, 95);
 }
 
+QVector<CommitBatch> AptWorker::commitBatches() const
+{
+    pkgDepCache *cache = m_cache->GetDepCache();
+    pkgCache &packageCache = cache->GetCache();
+
+    // Changed packages that can't be installed apart are joined up in a
+    // union-find over package IDs: those that conflict with or break each
+    // other, and those whose installed version depends on another. Unchanged
+    // packages stay at -1.
+    QVector<int> parents(packageCache.HeaderP->PackageCount, -1);
+    auto find = [&parents](int id) {
+        while (parents.at(id) != id) {
+            parents[id] = parents.at(parents.at(id));
+            id = parents.at(id);
+        }
+        return id;
+    };
+
+    QVector<pkgCache::PkgIterator> changed;
+    for (pkgCache::PkgIterator pkg = cache->PkgBegin(); !pkg.end(); ++pkg) {
+        const pkgDepCache::StateCache &state = (*cache)[pkg];
+
+        if (state.Mode == pkgDepCache::ModeKeep && !(state.iFlags & pkgDepCache::ReInstall))
+            continue;
+
+        parents[pkg->ID] = pkg->ID;
+        changed.append(pkg);
+    }
+
+    // A new version only needs what it depends on to go in first, so those
+    // dependencies are kept as edges, from the dependent package to its
+    // dependency
+    QVector<QPair<int, int>> edges;
+
+    for (const pkgCache::PkgIterator &pkg : changed) {
+        const pkgCache::VerIterator install = (*cache)[pkg].InstVerIter(*cache);
+        const pkgCache::VerIterator versions[] = { install, pkg.CurrentVer() };
+
+        for (const pkgCache::VerIterator &ver : versions) {
+            if (ver.end())
+                continue;
+
+            for (pkgCache::DepIterator dep = ver.DependsList(); !dep.end(); ++dep) {
+                const bool ordered = ver == install &&
+                                     (dep->Type == pkgCache::Dep::Depends ||
+                                      dep->Type == pkgCache::Dep::PreDepends);
+
+                QVector<int> targets;
+                targets.append(dep.TargetPkg()->ID);
+
+                // Packages providing the dependency count as well
+                std::unique_ptr<pkgCache::Version *[]> providers(dep.AllTargets());
+                for (pkgCache::Version **provider = providers.get(); *provider; ++provider)
+                    targets.append(pkgCache::VerIterator(packageCache, *provider).ParentPkg()->ID);
+
+                for (int target : targets) {
+                    if (parents.at(target) == -1 || target == int(pkg->ID))
+                        continue;
+
+                    if (ordered)
+                        edges.append(qMakePair(int(pkg->ID), target));
+                    else
+                        parents[find(target)] = find(pkg->ID);
+                }
+            }
+        }
+    }
+
+    QHash<int, QVector<int>> dependencies;
+    for (const QPair<int, int> &edge : edges) {
+        const int from = find(edge.first);
+        const int to = find(edge.second);
+
+        if (from != to)
+            dependencies[from].append(to);
+    }
+
+    // Groups that depend on each other in a cycle are joined up as well,
+    // as the strongly connected components of the edges. Tarjan's algorithm
+    // finishes each component only after those it depends on, which gives
+    // the order to install them in.
+    QHash<int, int> indexes;
+    QHash<int, int> lowLinks;
+    QVector<int> stack;
+    QSet<int> onStack;
+    QVector<int> order;
+
+    std::function<void(int)> visit = [&](int group) {
+        indexes.insert(group, indexes.size());
+        lowLinks.insert(group, indexes.value(group));
+        stack.append(group);
+        onStack.insert(group);
+
+        for (int dependency : dependencies.value(group)) {
+            if (!indexes.contains(dependency)) {
+                visit(dependency);
+                lowLinks[group] = qMin(lowLinks.value(group), lowLinks.value(dependency));
+            } else if (onStack.contains(dependency)) {
+                lowLinks[group] = qMin(lowLinks.value(group), indexes.value(dependency));
+            }
+        }
+
+        if (lowLinks.value(group) != indexes.value(group))
+            return;
+
+        int member;
+        do {
+            member = stack.takeLast();
+            onStack.remove(member);
+            parents[find(member)] = find(group);
+        } while (member != group);
+
+        order.append(find(group));
+    };
+
+    for (const pkgCache::PkgIterator &pkg : changed) {
+        const int group = find(pkg->ID);
+        if (!indexes.contains(group))
+            visit(group);
+    }
+
+    QHash<int, int> positions;
+    for (int i = 0; i < order.size(); ++i)
+        positions.insert(order.at(i), i);
+
+    // Gather up the components, dependencies first
+    QVector<CommitBatch> components(order.size());
+    for (const pkgCache::PkgIterator &pkg : changed) {
+        const pkgDepCache::StateCache &state = (*cache)[pkg];
+        CommitBatch &component = components[positions.value(find(pkg->ID))];
+
+        CommitBatch::Change change;
+        change.package = pkg.FullName(false);
+        change.automatic = state.Flags & pkgCache::Flag::Auto;
+
+        if (state.Mode == pkgDepCache::ModeInstall) {
+            change.action = CommitBatch::Install;
+            change.version = state.InstVerIter(*cache).VerStr();
+            component.downloadSize += state.InstVerIter(*cache)->Size;
+        } else if (state.Mode == pkgDepCache::ModeDelete) {
+            change.action = (state.iFlags & pkgDepCache::Purge) ? CommitBatch::Purge : CommitBatch::Remove;
+        } else {
+            change.action = CommitBatch::ReInstall;
+            component.downloadSize += pkg.CurrentVer()->Size;
+        }
+
+        component.changes.append(change);
+    }
+
+    // Small components are put together, so that trigger processing isn't
+    // repeated for each of them
+    const double batchSize = _config->FindI("QApt::Worker::StreamingCommit::BatchSize", 100) * 1048576.0;
+
+    QVector<CommitBatch> batches;
+    for (const CommitBatch &component : components) {
+        if (batches.isEmpty() || batches.last().downloadSize >= batchSize)
+            batches.append(CommitBatch());
+
+        batches.last().changes += component.changes;
+        batches.last().downloadSize += component.downloadSize;
+    }
+
+    // Only stream if every batch holds up once the ones before it are in
+    pkgDepCache scratch(&packageCache, m_cache->GetPolicy());
+    if (!scratch.Init(nullptr)) {
+        _error->Discard();
+        return QVector<CommitBatch>();
+    }
+
+    for (const CommitBatch &batch : batches) {
+        if (!markBatch(scratch, batch)) {
+            _error->Discard();
+            return QVector<CommitBatch>();
+        }
+    }
+
+    return batches;
+}
+
+bool AptWorker::commitInBatches(const QVector<CommitBatch> &batches)
+{
+    const int count = batches.size();
+
+    // Each batch gets a slice of the progress a plain commit goes through,
+    // the first half for its downloads and the second for its install
+    auto sliceBegin = [count](int i) { return 15 + 75 * i / count; };
+    auto sliceMiddle = [&sliceBegin](int i) { return (sliceBegin(i) + sliceBegin(i + 1)) / 2; };
+
+    // Looks at how a fetch went once it is finished. A preempted fetch
+    // sends the transaction back to the queue, and when it runs again it
+    // picks up from the batch that was left, since the ones before it are
+    // installed by then.
+    auto fetched = [this](BatchFetch *fetch) {
+        if (m_trans->isCancelled())
+            return false;
+
+        if (fetch->isPreempted()) {
+            m_preempted = true;
+            return false;
+        }
+
+        if (!fetch->succeeded()) {
+            m_trans->setError(QApt::FetchError);
+            return false;
+        }
+
+        return true;
+    };
+
+    QScopedPointer<BatchFetch> next(new BatchFetch(m_cache, m_trans, sliceBegin(0), sliceMiddle(0)));
+    if (!next->prepare(batches.mid(0, 1), m_cache->GetSourceList(), m_records)) {
+        m_trans->setError(QApt::FetchError);
+        return false;
+    }
+
+    next->start();
+
+    for (int i = 0; i < count; ++i) {
+        pkgCacheFile cacheFile;
+        QScopedPointer<pkgRecords> records;
+        QScopedPointer<BatchFetch> current(next.take());
+        current->wait();
+
+        if (!fetched(current.data()))
+            return false;
+
+        // The downloads were planned on the package states from before the
+        // commit. Past the first batch, the install is planned again on a
+        // cache read afresh, so that dpkg is ordered against the versions
+        // now installed and saving the states keeps the auto flags of the
+        // batches before. The archives should all be there by now, and
+        // anything missing is fetched before the next batch's downloads
+        // start, so that only one fetch writes to the archive cache.
+        if (i > 0) {
+            if (!cacheFile.ReadOnlyOpen(nullptr)) {
+                std::string message;
+                _error->PopMessage(message);
+
+                m_trans->setError(QApt::InitError);
+                m_trans->setErrorDetails(QString::fromStdString(message));
+                return false;
+            }
+
+            records.reset(new pkgRecords(cacheFile));
+            current.reset(new BatchFetch(&cacheFile, m_trans, sliceBegin(i), sliceMiddle(i)));
+            if (!current->prepare(batches.mid(i, 1), cacheFile.GetSourceList(), records.data())) {
+                m_trans->setError(QApt::FetchError);
+                return false;
+            }
+
+            if (!current->hasArchives()) {
+                current->start();
+                current->wait();
+
+                if (!fetched(current.data()))
+                    return false;
+            }
+        }
+
+        // Start on the next batch's downloads before installing this one.
+        // This one isn't in yet, so the batches up to the next are marked
+        // together, and only the next one's archives are left to fetch.
+        if (i + 1 < count) {
+            next.reset(new BatchFetch(m_cache, m_trans, sliceBegin(i + 1), sliceMiddle(i + 1)));
+            if (!next->prepare(batches.mid(0, i + 2), m_cache->GetSourceList(), m_records)) {
+                m_trans->setError(QApt::FetchError);
+                return false;
+            }
+            next->start();
+        } else {
+            emit archivesFetched(m_trans);
+        }
+
+        WorkerInstallProgress installProgress(sliceMiddle(i), sliceBegin(i + 1));
+        installProgress.setTransaction(m_trans);
+
+        if (installProgress.start(current->packageManager()) != pkgPackageManager::Completed) {
+            // Error details set by WorkerInstallProgress
+            m_trans->setError(QApt::CommitError);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QVariantMap AptWorker::changeManifest() const
+{
+    QVariantMap manifest;
+    pkgDepCache *depCache = m_cache->GetDepCache();
+
+    for (pkgCache::PkgIterator iter = depCache->PkgBegin(); !iter.end(); ++iter) {
+        const pkgDepCache::StateCache &state = (*depCache)[iter];
+        QApt::Package::State change;
+
+        // Same order of precedence as QApt::Package::state()
+        if (state.iFlags & pkgDepCache::ReInstall)
+            change = QApt::Package::ToReInstall;
+        else if (state.NewInstall())
+            change = QApt::Package::NewInstall;
+        else if (state.Upgrade())
+            change = QApt::Package::ToUpgrade;
+        else if (state.Downgrade())
+            change = QApt::Package::ToDowngrade;
+        else if (state.Delete())
+            change = (state.iFlags & pkgDepCache::Purge) ? QApt::Package::ToPurge
+                                                         : QApt::Package::ToRemove;
+        else
+            continue;
+
+        const pkgCache::VerIterator current = iter.CurrentVer();
+        const pkgCache::VerIterator install = state.InstVerIter(*depCache);
+
+        QVariantList entry;
+        entry << int(change)
+              << (current.end() ? QString() : QString::fromLatin1(current.VerStr()))
+              << (install.end() ? QString() : QString::fromLatin1(install.VerStr()));
+
+        manifest.insert(QString::fromStdString(iter.FullName(true)), entry);
+    }
+
+    return manifest;
+}
+
 void AptWorker::downloadArchives()
 {
     // Initialize fetcher with our progress watcher
@@ -615,6 +1708,7 @@ void AptWorker::downloadArchives()
                        m_trans->filePath().toStdString(), "");
     }
 
+    acquire->holdEnvironment();
     if (fetcher.Run() != pkgAcquire::Continue) {
         // Our fetcher will report warnings for itself, but if it fails entirely
         // we have to send the error and finished signals
@@ -634,7 +1728,7 @@ void AptWorker::installFile()
     // FIXME: bloody workaround.
     //        setTransaction contains logic WRT locale and debconf setup, which
     //        is also useful to dpkg. For now simply reuse WorkerInstallProgress
-    //        as it has no adverse effects.
+    //        for the environment to start dpkg in.
     WorkerInstallProgress installProgress(50, 90);
     installProgress.setTransaction(m_trans);
 
@@ -658,14 +1752,23 @@ void AptWorker::installFile()
     m_dpkgProcess = new QProcess(this);
     QString program = QLatin1String("dpkg") %
             QLatin1String(" -i ") % '"' % m_trans->filePath() % '"';
-    setenv("PATH", "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin", 1);
-    setenv("DEBIAN_FRONTEND", "passthrough", 1);
-    setenv("DEBCONF_PIPE", "/tmp/qapt-sock", 1);
-    m_dpkgProcess->start(program);
+    QProcessEnvironment environment = installProgress.processEnvironment();
+    environment.insert(QLatin1String("DEBIAN_FRONTEND"), QLatin1String("passthrough"));
+    environment.insert(QLatin1String("DEBCONF_PIPE"), QLatin1String("/tmp/qapt-sock"));
+    m_dpkgProcess->setProcessEnvironment(environment);
     connect(m_dpkgProcess, SIGNAL(started()), this, SLOT(dpkgStarted()));
     connect(m_dpkgProcess, SIGNAL(readyRead()), this, SLOT(updateDpkgProgress()));
     connect(m_dpkgProcess, SIGNAL(finished(int,QProcess::ExitStatus)),
             this, SLOT(dpkgFinished(int,QProcess::ExitStatus)));
+    m_dpkgProcess->start(program);
+
+    // finished() is never emitted for a process that did not start
+    if (!m_dpkgProcess->waitForStarted(-1)) {
+        m_trans->setError(QApt::CommitError);
+        m_trans->setErrorDetails(m_dpkgProcess->errorString());
+        delete m_dpkgProcess;
+        m_dpkgProcess = nullptr;
+    }
 }
 
 void AptWorker::dpkgStarted()
@@ -675,9 +1778,18 @@ void AptWorker::dpkgStarted()
 
 void AptWorker::updateDpkgProgress()
 {
-    QString str = m_dpkgProcess->readLine();
+    if (!m_dpkgProcess)
+        return;
+
+    const QByteArray output = m_dpkgProcess->readAll();
+    m_trans->writeTerminal(output.constData(), output.size());
+
+    // Only the latest line is of interest for the status details
+    const QByteArray lines = output.trimmed();
+    if (lines.isEmpty())
+        return;
 
-    m_trans->setStatusDetails(str);
+    m_trans->setStatusDetails(QString::fromUtf8(lines.mid(lines.lastIndexOf('\n') + 1)));
 }
 
 void AptWorker::dpkgFinished(int exitCode, QProcess::ExitStatus exitStatus)
@@ -23,41 +23,89 @@
 
 #include <QMutex>
 #include <QProcess>
+#include <QVariantMap>
 #include <QVector>
 
+#include "globals.h"
+
+class QFileSystemWatcher;
 class QProcess;
+class QTimer;
 
+class OpProgress;
+class pkgAcquire;
 class pkgCacheFile;
 class pkgRecords;
 
 class AptLock;
 class Transaction;
+struct CommitBatch;
 
 class AptWorker : public QObject
 {
     Q_OBJECT
 public:
-    explicit AptWorker(QObject *parent = 0);
+    /**
+     * The package system locks, which decide whether two transactions can
+     * be run at the same time
+     */
+    enum Lock {
+        NoLocks = 0,
+        ArchivesLock = 1 << 0,
+        ListsLock = 1 << 1,
+        StatusLock = 1 << 2
+    };
+
+    /**
+     * @param primary Whether this is the daemon's main worker. Only the
+     * main worker initializes the package system and keeps a standby
+     * cache; others are extra contexts for running transactions alongside
+     * it.
+     */
+    explicit AptWorker(QObject *parent = 0, bool primary = true);
     ~AptWorker();
 
+    /**
+     * Returns the locks, as a combination of Lock values, that transactions
+     * of the given @p role take. Transactions whose locks overlap must not
+     * run at the same time.
+     */
+    static int locksForRole(QApt::TransactionRole role);
+
     Transaction *currentTransaction();
     quint64 lastActiveTimestamp();
 
+    /**
+     * Returns the QApt::Worker::StandbyTimeout setting: the number of
+     * seconds the worker stays idle with a warm cache before exiting, 0 if
+     * standby is disabled, or a negative number to never exit.
+     */
+    int standbyTimeout();
+
 private:
+    bool m_primary;
     pkgCacheFile *m_cache;
     pkgRecords *m_records;
+    // Also guards m_lastActiveTimestamp, so that idle checks see both
+    // change together
     QMutex m_transMutex;
     Transaction *m_trans;
+    QList<Transaction *> m_merged;
+    bool m_preempted;
     bool m_ready;
     QVector<AptLock *> m_locks;
-    QMutex m_timestampMutex;
+    QMutex m_standbyMutex;
     quint64 m_lastActiveTimestamp;
     QProcess *m_dpkgProcess;
+    QByteArray m_cacheStamp;
+    int m_standbyTimeout;
+    QFileSystemWatcher *m_cacheWatcher;
+    QTimer *m_refreshTimer;
 
     /**
-     * If the locks on the package system cannot be immediately taken, this
-     * function will wait until the package system is unlocked, and proceed
-     * to lock it.
+     * If the locks the current transaction needs cannot be immediately
+     * taken, this function will wait until the package system is unlocked,
+     * and proceed to lock it.
      */
     void waitForLocks();
 
@@ -67,10 +115,43 @@ private:
     void cleanupCurrentTransaction();
 
     /**
-     * Builds the package cache and package records.
+     * Releases APT locks and hands the transaction, along with any merged
+     * in to it, back to the queue after its downloads were preempted.
+     */
+    void requeueCurrentTransaction();
+
+    /**
+     * Resets @p trans to waiting and lets the queue run it again later
+     */
+    void returnToQueue(Transaction *trans);
+
+    /**
+     * Builds the package cache and package records. If they are already
+     * open and nothing they are built from has changed, only the package
+     * states are reset.
      */
     void openCache(int begin = 0, int end = 5);
 
+    /**
+     * Does the work of openCache(), independently of any transaction.
+     *
+     * @return @c false if the cache could not be opened, with the reason
+     * left in the APT error stack
+     */
+    bool loadCache(OpProgress *progress);
+
+    /**
+     * Watches the files the package cache is built from, so that a warm
+     * standby cache can be refreshed when they change
+     */
+    void watchCacheSources();
+
+    /**
+     * Returns the stamps of the files the package cache is built from, used
+     * to tell whether the open cache is still current.
+     */
+    QByteArray cacheStamp() const;
+
     /**
      * Checks for and downloads new package source lists.
      */
@@ -81,11 +162,63 @@ private:
      */
     bool markChanges();
 
+    /**
+     * Marks the changes of the current transaction together with those of
+     * the transactions merged into it
+     *
+     * @return @c false if they can't all be marked at once
+     */
+    bool markMergedChanges();
+
+    /**
+     * Falls back to running the current transaction on its own when the
+     * merged transactions couldn't be marked together, and hands the rest
+     * back to the queue
+     */
+    void runMergedSeparately();
+
+    /**
+     * Marks the given changes, in the format of the transaction packages
+     * property. On failure, @p error and @p details say what went wrong.
+     */
+    bool markPackages(const QVariantMap &packages, QApt::ErrorCode &error,
+                      QString &details);
+
+    /**
+     * Does the work of prefetchArchives()
+     */
+    void fetchAhead(Transaction *trans);
+
+    /**
+     * Returns whether the archives queued in @p fetcher are worth fetching
+     * ahead: within the size cap, leaving enough disk space, and trusted
+     */
+    bool canFetchAhead(pkgAcquire &fetcher) const;
+
     /**
      * Runs an APT commit
      */
     void commitChanges();
 
+    /**
+     * Splits the marked changes into batches that can each be installed
+     * once the ones before them are, for the QApt::Worker::StreamingCommit
+     * mode. Returns no batches if the changes can't be split up.
+     */
+    QVector<CommitBatch> commitBatches() const;
+
+    /**
+     * Installs the given batches in order, downloading the archives for
+     * each batch while the one before it is being installed
+     */
+    bool commitInBatches(const QVector<CommitBatch> &batches);
+
+    /**
+     * Describes the changes currently marked in the cache, in the format of
+     * the ChangeManifestProperty transaction property
+     */
+    QVariantMap changeManifest() const;
+
     /**
      * Upgrades packages
      */
@@ -118,13 +251,37 @@ public slots:
      */
     void runTransaction(Transaction *trans);
 
+    /**
+     * Downloads the archives a waiting commit or upgrade transaction will
+     * need into the archive cache, without otherwise touching the
+     * transaction. Emits archivesPrefetched() when done.
+     *
+     * Governed by the QApt::Worker::Prefetch, QApt::Worker::Prefetch::MaxSize
+     * (in MiB) and QApt::Worker::Prefetch::DownloadLimit (in KiB/s) options.
+     *
+     * @param trans The waiting transaction
+     */
+    void prefetchArchives(Transaction *trans);
+
     /**
      * Stops the separate thread that AptWorker lives in. Call this before
      * exit to prevent the thread from whining that it was destroyed on shutdown.
      */
     void quit();
 
+signals:
+    void archivesPrefetched(Transaction *trans);
+
+    /**
+     * Emitted once the running transaction @p trans is done writing to the
+     * archive cache, and only has dpkg work left
+     */
+    void archivesFetched(Transaction *trans);
+    void transactionPreempted(Transaction *trans);
+
 private slots:
+    void scheduleCacheRefresh();
+    void refreshCache();
     void dpkgStarted();
     void updateDpkgProgress();
     void dpkgFinished(int exitCode, QProcess::ExitStatus exitStatus);
@@ -0,0 +1,192 @@
+/***************************************************************************
+ *   Copyright © 2026 agent <agent@local>                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or         *
+ *   modify it under the terms of the GNU General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of        *
+ *   the License or (at your option) version 3 or any later version        *
+ *   accepted by the membership of KDE e.V. (or its successor approved     *
+ *   by the membership of KDE e.V.), which shall act as a proxy            *
+ *   defined in Section 14 of version 3 of the license.                    *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef DPKGSTATUSREADER_H
+#define DPKGSTATUSREADER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * A field of a status line, pointing into the reader's buffer. Only valid
+ * until the line handler returns.
+ */
+struct DpkgStatusField
+{
+    const char *data;
+    int size;
+
+    bool isEmpty() const { return size == 0; }
+
+    bool startsWith(const char *prefix) const
+    {
+        const int length = strlen(prefix);
+        return size >= length && memcmp(data, prefix, length) == 0;
+    }
+
+    QString toString() const { return QString::fromUtf8(data, size); }
+};
+
+/**
+ * One line of APT's progress fd, e.g.
+ * "pmstatus:libfoo:42.8571:Installing libfoo (amd64)"
+ */
+struct DpkgStatusLine
+{
+    DpkgStatusField status;
+    DpkgStatusField package;
+    DpkgStatusField percent;
+    // Everything after the third colon, which can have colons of its own
+    DpkgStatusField message;
+
+    /// The whole part of the percentage
+    int percentage() const
+    {
+        int value = 0;
+        for (int i = 0; i < percent.size && percent.data[i] >= '0' && percent.data[i] <= '9'; ++i)
+            value = value * 10 + (percent.data[i] - '0');
+
+        return value;
+    }
+};
+
+/**
+ * Splits the status fd of a dpkg run into lines, reading it in chunks.
+ *
+ * Lines are parsed in place in a buffer that only grows to fit the longest
+ * line seen, so no allocation is made per line or per character. This is
+ * kept header-only so that the parser benchmark can use it without the
+ * rest of the worker.
+ */
+class DpkgStatusReader
+{
+public:
+    DpkgStatusReader()
+        : m_start(0)
+        , m_end(0)
+    {
+    }
+
+    /**
+     * Reads everything that is currently available on @p fd, which should
+     * be non-blocking.
+     *
+     * @return @c false if the other end hung up or reading failed
+     */
+    bool readFrom(int fd)
+    {
+        while (true) {
+            reserve(s_chunkSize);
+
+            const ssize_t length = read(fd, m_buffer.data() + m_end, s_chunkSize);
+            if (length > 0) {
+                m_end += length;
+                continue;
+            }
+
+            return length < 0 && (errno == EAGAIN || errno == EINTR);
+        }
+    }
+
+    void append(const char *data, int size)
+    {
+        reserve(size);
+        memcpy(m_buffer.data() + m_end, data, size);
+        m_end += size;
+    }
+
+    /**
+     * Calls @p handler with each complete line received so far. Malformed
+     * lines are skipped, and an incomplete last line is kept for the next
+     * call.
+     */
+    template<typename Handler>
+    void takeLines(Handler handler)
+    {
+        const char *const buffer = m_buffer.constData();
+
+        while (m_start < m_end) {
+            const char *begin = buffer + m_start;
+            const char *newline = static_cast<const char *>(memchr(begin, '\n', m_end - m_start));
+            if (!newline)
+                break;
+
+            m_start = newline - buffer + 1;
+
+            DpkgStatusLine line;
+            if (parse(begin, newline, line))
+                handler(line);
+        }
+
+        if (m_start == m_end) {
+            m_start = 0;
+            m_end = 0;
+        }
+    }
+
+private:
+    static const int s_chunkSize = 4096;
+
+    QByteArray m_buffer;
+    int m_start;
+    int m_end;
+
+    void reserve(int size)
+    {
+        if (m_buffer.size() - m_end >= size)
+            return;
+
+        // Move the unfinished line to the front before growing
+        if (m_start > 0) {
+            memmove(m_buffer.data(), m_buffer.constData() + m_start, m_end - m_start);
+            m_end -= m_start;
+            m_start = 0;
+        }
+
+        if (m_buffer.size() - m_end < size)
+            m_buffer.resize(qMax(m_buffer.size() * 2, m_end + size));
+    }
+
+    static bool parse(const char *begin, const char *end, DpkgStatusLine &line)
+    {
+        DpkgStatusField *fields[] = { &line.status, &line.package, &line.percent };
+
+        for (DpkgStatusField *field : fields) {
+            const char *colon = static_cast<const char *>(memchr(begin, ':', end - begin));
+            if (!colon)
+                return false;
+
+            field->data = begin;
+            field->size = colon - begin;
+            begin = colon + 1;
+        }
+
+        line.message.data = begin;
+        line.message.size = end - begin;
+
+        return !line.status.isEmpty() && !line.package.isEmpty();
+    }
+};
+
+#endif
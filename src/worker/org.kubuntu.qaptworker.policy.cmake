@@ -30,6 +30,14 @@
       <allow_active>auth_admin_keep</allow_active>
     </defaults>
   </action>
+  <action id="@QAPT_WORKER_RDN_VERSIONED@.setpriority">
+    <description>Run a task ahead of others</description>
+    <message>To run software changes ahead of other tasks, you need to authenticate.</message>
+    <defaults>
+      <allow_inactive>no</allow_inactive>
+      <allow_active>auth_admin_keep</allow_active>
+    </defaults>
+  </action>
   <action id="@QAPT_WORKER_RDN_VERSIONED@.cancelforeign">
     <description>Cancel the task of another user</description>
     <message> To cancel someone else's software changes, you need to authenticate.</message>
@@ -12,6 +12,7 @@
     <property name="packages" type="a{sv}" access="read">
       <annotation name="org.qtproject.QtDBus.QtTypeName" value="QVariantMap"/>
     </property>
+    <property name="priority" type="i" access="read"/>
     <property name="isCancellable" type="b" access="read"/>
     <property name="isCancelled" type="b" access="read"/>
     <property name="exitStatus" type="i" access="read"/>
@@ -27,10 +28,17 @@
     <property name="filePath" type="s" access="read"/>
     <property name="errorDetails" type="s" access="read"/>
     <property name="frontendCaps" type="i" access="read"/>
+    <property name="changeManifest" type="a{sv}" access="read">
+      <annotation name="org.qtproject.QtDBus.QtTypeName" value="QVariantMap"/>
+    </property>
     <signal name="propertyChanged">
       <arg name="role" type="i" direction="out"/>
       <arg name="newValue" type="v" direction="out"/>
     </signal>
+    <signal name="propertiesChanged">
+      <arg name="properties" type="a{iv}" direction="out"/>
+      <annotation name="org.qtproject.QtDBus.QtTypeName.Out0" value="QApt::PropertyMap"/>
+    </signal>
     <signal name="finished">
       <arg name="exitStatus" type="i" direction="out"/>
     </signal>
@@ -63,6 +71,9 @@
       <arg name="currentPath" type="s" direction="in"/>
       <arg name="replace" type="b" direction="in"/>
     </method>
+    <method name="attachTerminal">
+      <arg name="fd" type="h" direction="in"/>
+    </method>
     <method name="setFrontendCaps">
         <arg name="caps" type="i" direction="in"/>
     </method>
@@ -32,8 +32,33 @@
 #include "transactionqueue.h"
 #include "worker/urihelper.h"
 
+// Apt includes
+#include <apt-pkg/configuration.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+
 #define IDLE_TIMEOUT 30000 // 30 seconds
 
+Transaction::State::State(QApt::TransactionRole role, const QVariantMap &packages)
+    : role(role)
+    , status(QApt::SetupStatus)
+    , error(QApt::Success)
+    , packages(packages)
+    , isCancellable(true)
+    , isCancelled(false)
+    , exitStatus(QApt::ExitUnfinished)
+    , isPaused(false)
+    , allowUntrusted(false)
+    , safeUpgrade(true)
+    , replaceConfFile(false)
+    , frontendCaps(QApt::NoCaps)
+    , priority(QApt::InteractivePriority)
+    , preemptionRequested(false)
+    , mergeable(true)
+{
+}
+
 Transaction::Transaction(TransactionQueue *queue, int userId)
     : Transaction(queue, userId, QApt::EmptyRole, QVariantMap())
 {
@@ -44,21 +69,12 @@ Transaction::Transaction(TransactionQueue *queue, int userId,
     : QObject(queue)
     , m_queue(queue)
     , m_uid(userId)
-    , m_role(role)
-    , m_status(QApt::SetupStatus)
-    , m_error(QApt::Success)
-    , m_packages(packagesList)
-    , m_isCancellable(true)
-    , m_isCancelled(false)
-    , m_exitStatus(QApt::ExitUnfinished)
-    , m_isPaused(false)
+    , m_state(std::make_shared<State>(role, packagesList))
     , m_progress(0)
-    , m_allowUntrusted(false)
     , m_downloadSpeed(0)
-    , m_safeUpgrade(true)
-    , m_replaceConfFile(false)
-    , m_frontendCaps(QApt::NoCaps)
+    , m_ETA(0)
     , m_dataMutex(QMutex::Recursive)
+    , m_updateInterval(_config->FindI("QApt::Worker::PropertyUpdateInterval", 50))
 {
     new TransactionAdaptor(this);
     QDBusConnection connection = QDBusConnection::systemBus();
@@ -83,6 +99,11 @@ Transaction::Transaction(TransactionQueue *queue, int userId,
     m_idleTimer->start(IDLE_TIMEOUT);
     connect(m_idleTimer, SIGNAL(timeout()),
             this, SLOT(emitIdleTimeout()));
+
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    connect(m_flushTimer, SIGNAL(timeout()),
+            this, SLOT(flushProperties()));
 }
 
 Transaction::~Transaction()
@@ -90,6 +111,24 @@ Transaction::~Transaction()
     QDBusConnection::systemBus().unregisterObject(m_tid);
 }
 
+std::shared_ptr<const Transaction::State> Transaction::state() const
+{
+    return std::atomic_load(&m_state);
+}
+
+template<typename Update>
+void Transaction::updateState(Update update)
+{
+    // Writers are serialized by the data mutex. Readers keep whichever
+    // version they loaded, so it is copied rather than changed in place.
+    // The copy is cheap, since Qt's containers and strings are shared.
+    QMutexLocker lock(&m_dataMutex);
+
+    std::shared_ptr<State> next = std::make_shared<State>(*m_state);
+    update(*next);
+    std::atomic_store(&m_state, std::shared_ptr<const State>(std::move(next)));
+}
+
 QString Transaction::transactionId() const
 {
     return m_tid;
@@ -102,40 +141,36 @@ int Transaction::userId() const
 
 int Transaction::role()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_role;
+    return state()->role;
 }
 
 void Transaction::setRole(int role)
 {
     QMutexLocker lock(&m_dataMutex);
     // Cannot change role for an already determined transaction
-    if (m_role != QApt::EmptyRole) {
+    if (state()->role != QApt::EmptyRole) {
         sendErrorReply(QDBusError::Failed);
 
         return;
     }
 
-    m_role = (QApt::TransactionRole)role;
+    updateState([&](State &state) { state.role = (QApt::TransactionRole)role; });
 
-    emit propertyChanged(QApt::RoleProperty, QDBusVariant(role));
+    notifyPropertyChanged(QApt::RoleProperty, role);
 }
 
 int Transaction::status()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_status;
+    return state()->status;
 }
 
 void Transaction::setStatus(QApt::TransactionStatus status)
 {
     QMutexLocker lock(&m_dataMutex);
-    m_status = status;
-    emit propertyChanged(QApt::StatusProperty, QDBusVariant((int)status));
+    updateState([&](State &state) { state.status = status; });
+    notifyPropertyChanged(QApt::StatusProperty, (int)status);
 
-    if (m_status != QApt::SetupStatus && m_idleTimer) {
+    if (status != QApt::SetupStatus && m_idleTimer) {
         m_idleTimer->stop(); // We are now queued and are no longer idle
         // We don't need the timer anymore
         m_idleTimer->deleteLater();
@@ -145,69 +180,63 @@ void Transaction::setStatus(QApt::TransactionStatus status)
 
 int Transaction::error()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_error;
+    return state()->error;
 }
 
 void Transaction::setError(QApt::ErrorCode code)
 {
-    m_error = code;
-    emit propertyChanged(QApt::ErrorProperty, QDBusVariant((int)code));
+    QMutexLocker lock(&m_dataMutex);
+
+    updateState([&](State &state) { state.error = code; });
+    notifyPropertyChanged(QApt::ErrorProperty, (int)code);
 }
 
 QString Transaction::locale()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_locale;
+    return state()->locale;
 }
 
 void Transaction::setLocale(QString locale)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    if (m_status != QApt::SetupStatus) {
+    if (state()->status != QApt::SetupStatus) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
 
-    m_locale = locale;
-    emit propertyChanged(QApt::LocaleProperty, QDBusVariant(locale));
+    updateState([&](State &state) { state.locale = locale; });
+    notifyPropertyChanged(QApt::LocaleProperty, locale);
 }
 
 QString Transaction::proxy()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_proxy;
+    return state()->proxy;
 }
 
 void Transaction::setProxy(QString proxy)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    if (m_status != QApt::SetupStatus) {
+    if (state()->status != QApt::SetupStatus) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
 
-    m_proxy = proxy;
-    emit propertyChanged(QApt::ProxyProperty, QDBusVariant(proxy));
+    updateState([&](State &state) { state.proxy = proxy; });
+    notifyPropertyChanged(QApt::ProxyProperty, proxy);
 }
 
 QString Transaction::debconfPipe()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_debconfPipe;
+    return state()->debconfPipe;
 }
 
 void Transaction::setDebconfPipe(QString pipe)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    if (m_status != QApt::SetupStatus) {
+    if (state()->status != QApt::SetupStatus) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
@@ -219,82 +248,74 @@ void Transaction::setDebconfPipe(QString pipe)
         return;
     }
 
-    m_debconfPipe = pipe;
-    emit propertyChanged(QApt::DebconfPipeProperty, QDBusVariant(pipe));
+    updateState([&](State &state) { state.debconfPipe = pipe; });
+    notifyPropertyChanged(QApt::DebconfPipeProperty, pipe);
 }
 
 QVariantMap Transaction::packages()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_packages;
+    return state()->packages;
 }
 
 void Transaction::setPackages(QVariantMap packageList)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    if (m_status != QApt::SetupStatus) {
+    if (state()->status != QApt::SetupStatus) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
 
-    m_packages = packageList;
-    emit propertyChanged(QApt::PackagesProperty, QDBusVariant(packageList));
+    updateState([&](State &state) { state.packages = packageList; });
+    notifyPropertyChanged(QApt::PackagesProperty, packageList);
 }
 
 bool Transaction::isCancellable()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_isCancellable;
+    return state()->isCancellable;
 }
 
 void Transaction::setCancellable(bool cancellable)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_isCancellable = cancellable;
-    emit propertyChanged(QApt::CancellableProperty, QDBusVariant(cancellable));
+    updateState([&](State &state) { state.isCancellable = cancellable; });
+    notifyPropertyChanged(QApt::CancellableProperty, cancellable);
 }
 
 bool Transaction::isCancelled()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_isCancelled;
+    return state()->isCancelled;
 }
 
 int Transaction::exitStatus()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return (int)m_exitStatus;
+    return (int)state()->exitStatus;
 }
 
 void Transaction::setExitStatus(QApt::ExitStatus exitStatus)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_exitStatus = exitStatus;
-    emit propertyChanged(QApt::ExitStatusProperty, QDBusVariant(exitStatus));
+    updateState([&](State &state) { state.exitStatus = exitStatus; });
+    notifyPropertyChanged(QApt::ExitStatusProperty, (int)exitStatus);
     setStatus(QApt::FinishedStatus);
     emit finished(exitStatus);
 }
 
 QString Transaction::medium()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_medium;
+    return state()->medium;
 }
 
 void Transaction::setMediumRequired(const QString &label, const QString &medium)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_medium = medium;
-    m_isPaused = true;
+    updateState([&](State &state) {
+        state.medium = medium;
+        state.isPaused = true;
+    });
 
     emit mediumRequired(label, medium);
 }
@@ -303,45 +324,72 @@ void Transaction::setConfFileConflict(const QString &currentPath, const QString
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_isPaused = true;
-    m_currentConfPath = currentPath;
+    updateState([&](State &state) {
+        state.isPaused = true;
+        state.currentConfPath = currentPath;
+    });
 
     emit configFileConflict(currentPath, newPath);
 }
 
 bool Transaction::isPaused()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_isPaused;
+    return state()->isPaused;
 }
 
 void Transaction::setIsPaused(bool paused)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_isPaused = paused;
+    updateState([&](State &state) { state.isPaused = paused; });
+
+    lock.unlock();
+    wakePausedWaiters();
 }
 
-QString Transaction::statusDetails()
+void Transaction::waitWhilePaused()
 {
-    QMutexLocker lock(&m_dataMutex);
+    // The data mutex is recursive, which wait conditions can't work with
+    QMutexLocker locker(&m_pauseMutex);
+
+    while (isPaused())
+        m_pauseCondition.wait(&m_pauseMutex);
+}
+
+bool Transaction::waitForInterruption(unsigned long msecs)
+{
+    QMutexLocker locker(&m_pauseMutex);
+
+    if (!isCancelled() && !isPreemptionRequested())
+        m_pauseCondition.wait(&m_pauseMutex, msecs);
+
+    return isCancelled() || isPreemptionRequested();
+}
+
+void Transaction::wakePausedWaiters()
+{
+    // Must not be called with the data mutex held, since waitWhilePaused()
+    // takes the two the other way round
+    QMutexLocker locker(&m_pauseMutex);
 
-    return m_statusDetails;
+    m_pauseCondition.wakeAll();
+}
+
+QString Transaction::statusDetails()
+{
+    return state()->statusDetails;
 }
 
 void Transaction::setStatusDetails(const QString &details)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_statusDetails = details;
-    emit propertyChanged(QApt::StatusDetailsProperty, QDBusVariant(details));
+    updateState([&](State &state) { state.statusDetails = details; });
+    notifyPropertyChanged(QApt::StatusDetailsProperty, details);
 }
 
 int Transaction::progress()
 {
-    QMutexLocker lock(&m_dataMutex);
-
     return m_progress;
 }
 
@@ -350,7 +398,7 @@ void Transaction::setProgress(int progress)
     QMutexLocker lock(&m_dataMutex);
 
     m_progress = progress;
-    emit propertyChanged(QApt::ProgressProperty, QDBusVariant(progress));
+    notifyPropertyChanged(QApt::ProgressProperty, progress);
 }
 
 QString Transaction::service() const
@@ -360,18 +408,31 @@ QString Transaction::service() const
 
 QApt::DownloadProgress Transaction::downloadProgress()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_downloadProgress;
+    return state()->downloadProgress;
 }
 
-void Transaction::setDownloadProgress(const QApt::DownloadProgress &downloadProgress)
+void Transaction::setDownloadProgressBatch(const QApt::DownloadProgressBatch &batch)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_downloadProgress = downloadProgress;
-    emit propertyChanged(QApt::DownloadProgressProperty,
-                         QDBusVariant(QVariant::fromValue((downloadProgress))));
+    if (batch.isEmpty())
+        return;
+
+    for (const QApt::DownloadProgressRecord &record : batch) {
+        if (!record.uri.isEmpty())
+            m_downloadItems.insert(record.id, qMakePair(record.uri, record.shortDescription));
+    }
+
+    // The batch itself only makes sense after the ones before it, so only
+    // its latest item is kept, for the downloadProgress property
+    const QApt::DownloadProgressRecord &latest = batch.last();
+    const QPair<QString, QString> item = m_downloadItems.value(latest.id);
+    const QApt::DownloadProgress progress(item.first, (QApt::DownloadStatus)latest.status,
+                                          item.second, latest.fileSize,
+                                          latest.fetchedSize, latest.statusMessage);
+
+    updateState([&](State &state) { state.downloadProgress = progress; });
+    notifyPropertyChanged(QApt::DownloadProgressBatchProperty, QVariant::fromValue(batch));
 }
 
 void Transaction::setService(const QString &service)
@@ -381,33 +442,29 @@ void Transaction::setService(const QString &service)
 
 QStringList Transaction::untrustedPackages()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_untrusted;
+    return state()->untrusted;
 }
 
 void Transaction::setUntrustedPackages(const QStringList &untrusted, bool promptUser)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_untrusted = untrusted;
-    emit propertyChanged(QApt::UntrustedPackagesProperty, QDBusVariant(untrusted));
+    updateState([&](State &state) { state.untrusted = untrusted; });
+    notifyPropertyChanged(QApt::UntrustedPackagesProperty, untrusted);
 
     if (promptUser) {
-        m_isPaused = true;
+        updateState([&](State &state) { state.isPaused = true; });
         emit promptUntrusted(untrusted);
     }
 }
 
 bool Transaction::allowUntrusted()
 {
-    return m_allowUntrusted;
+    return state()->allowUntrusted;
 }
 
 quint64 Transaction::downloadSpeed()
 {
-    QMutexLocker lock(&m_dataMutex);
-
     return m_downloadSpeed;
 }
 
@@ -416,13 +473,11 @@ void Transaction::setDownloadSpeed(quint64 downloadSpeed)
     QMutexLocker lock(&m_dataMutex);
 
     m_downloadSpeed = downloadSpeed;
-    emit propertyChanged(QApt::DownloadSpeedProperty, QDBusVariant(downloadSpeed));
+    notifyPropertyChanged(QApt::DownloadSpeedProperty, downloadSpeed);
 }
 
 quint64 Transaction::downloadETA()
 {
-    QMutexLocker lock(&m_dataMutex);
-
     return m_ETA;
 }
 
@@ -431,57 +486,53 @@ void Transaction::setETA(quint64 ETA)
     QMutexLocker lock(&m_dataMutex);
 
     m_ETA = ETA;
-    emit propertyChanged(QApt::DownloadETAProperty, QDBusVariant(ETA));
+    notifyPropertyChanged(QApt::DownloadETAProperty, ETA);
 }
 
 QString Transaction::filePath()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_filePath;
+    return state()->filePath;
 }
 
 void Transaction::setFilePath(const QString &filePath)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_filePath = filePath;
-    emit propertyChanged(QApt::FilePathProperty, QDBusVariant(filePath));
+    updateState([&](State &state) { state.filePath = filePath; });
+    notifyPropertyChanged(QApt::FilePathProperty, filePath);
 }
 
 QString Transaction::errorDetails()
 {
-    QMutexLocker lock(&m_dataMutex);
-
-    return m_errorDetails;
+    return state()->errorDetails;
 }
 
 void Transaction::setErrorDetails(const QString &errorDetails)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_errorDetails = errorDetails;
-    emit propertyChanged(QApt::ErrorDetailsProperty, QDBusVariant(errorDetails));
+    updateState([&](State &state) { state.errorDetails = errorDetails; });
+    notifyPropertyChanged(QApt::ErrorDetailsProperty, errorDetails);
 }
 
 bool Transaction::safeUpgrade() const
 {
-    return m_safeUpgrade;
+    return state()->safeUpgrade;
 }
 
 void Transaction::setSafeUpgrade(bool safeUpgrade)
 {
-    m_safeUpgrade = safeUpgrade;
+    updateState([&](State &state) { state.safeUpgrade = safeUpgrade; });
 }
 
 bool Transaction::replaceConfFile() const
 {
-    return m_replaceConfFile;
+    return state()->replaceConfFile;
 }
 
 int Transaction::frontendCaps() const
 {
-    return m_frontendCaps;
+    return state()->frontendCaps;
 }
 
 void Transaction::run()
@@ -509,7 +560,7 @@ bool Transaction::isForeignUser() const
 bool Transaction::authorizeRun()
 {
     m_dataMutex.lock();
-    QString action = m_roleActionMap.value(m_role);
+    QString action = m_roleActionMap.value(state()->role);
     m_dataMutex.unlock();
 
     // Some actions don't need authorizing, and are run in the worker
@@ -557,6 +608,9 @@ void Transaction::setProperty(int property, QDBusVariant value)
     case QApt::FrontendCapsProperty:
         setFrontendCaps(value.variant().toInt());
         break;
+    case QApt::PriorityProperty:
+        setPriority(value.variant().toInt());
+        break;
     default:
         sendErrorReply(QDBusError::InvalidArgs);
         break;
@@ -575,14 +629,19 @@ void Transaction::cancel()
 
     QMutexLocker lock(&m_dataMutex);
     // We can only cancel cancellable transactions, obviously
-    if (!m_isCancellable) {
+    if (!state()->isCancellable) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
 
-    m_isCancelled = true;
-    m_isPaused = false;
-    emit propertyChanged(QApt::CancelledProperty, QDBusVariant(m_isCancelled));
+    updateState([&](State &state) {
+        state.isCancelled = true;
+        state.isPaused = false;
+    });
+    notifyPropertyChanged(QApt::CancelledProperty, true);
+
+    lock.unlock();
+    wakePausedWaiters();
 }
 
 void Transaction::provideMedium(const QString &medium)
@@ -595,13 +654,16 @@ void Transaction::provideMedium(const QString &medium)
     }
 
     // An incorrect medium was provided, or no medium was requested
-    if (medium != m_medium || m_medium.isEmpty()) {
+    if (medium != state()->medium || medium.isEmpty()) {
         sendErrorReply(QDBusError::Failed);
         return;
     }
 
     // The medium has now been provided, and the installation should be able to continue
-    m_isPaused = false;
+    updateState([&](State &state) { state.isPaused = false; });
+
+    lock.unlock();
+    wakePausedWaiters();
 }
 
 void Transaction::replyUntrustedPrompt(bool approved)
@@ -613,29 +675,283 @@ void Transaction::replyUntrustedPrompt(bool approved)
         return;
     }
 
-    m_allowUntrusted = approved;
-    m_isPaused = false;
+    updateState([&](State &state) {
+        state.allowUntrusted = approved;
+        state.isPaused = false;
+    });
+
+    lock.unlock();
+    wakePausedWaiters();
 }
 
 void Transaction::resolveConfigFileConflict(const QString &currentPath, bool replaceFile)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    if (currentPath != m_currentConfPath)
+    if (currentPath != state()->currentConfPath)
         replaceFile = false; // Client is buggy, assume keep to be safe
 
-    m_replaceConfFile = replaceFile;
-    m_isPaused = false;
+    updateState([&](State &state) {
+        state.replaceConfFile = replaceFile;
+        state.isPaused = false;
+    });
+
+    lock.unlock();
+    wakePausedWaiters();
+}
+
+void Transaction::attachTerminal(const QDBusUnixFileDescriptor &fd)
+{
+    if (isForeignUser()) {
+        sendErrorReply(QDBusError::AccessDenied);
+        return;
+    }
+
+    // Only stream sockets can be written to without blocking or raising
+    // SIGPIPE, and without changing flags the client's end shares with ours
+    int type = 0;
+    socklen_t length = sizeof(type);
+    if (!fd.isValid() ||
+        getsockopt(fd.fileDescriptor(), SOL_SOCKET, SO_TYPE, &type, &length) < 0 ||
+        type != SOCK_STREAM) {
+        sendErrorReply(QDBusError::InvalidArgs);
+        return;
+    }
+
+    QMutexLocker lock(&m_dataMutex);
+
+    m_terminal = fd;
+}
+
+void Transaction::writeTerminal(const char *data, int size)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    const QList<Transaction *> merged = m_merged;
+
+    const char *pending = data;
+    int remaining = size;
+    while (m_terminal.isValid() && remaining > 0) {
+        ssize_t written = send(m_terminal.fileDescriptor(), pending, remaining,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        // Drop whatever the client is too slow for, so dpkg never waits
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        // The client went away
+        if (written < 0) {
+            m_terminal = QDBusUnixFileDescriptor();
+            break;
+        }
+
+        pending += written;
+        remaining -= written;
+    }
+
+    lock.unlock();
+
+    for (Transaction *trans : merged)
+        trans->writeTerminal(data, size);
 }
 
 void Transaction::setFrontendCaps(int frontendCaps)
 {
     QMutexLocker lock(&m_dataMutex);
 
-    m_frontendCaps = (QApt::FrontendCaps)frontendCaps;
+    updateState([&](State &state) { state.frontendCaps = (QApt::FrontendCaps)frontendCaps; });
+}
+
+QVariantMap Transaction::changeManifest()
+{
+    return state()->changeManifest;
+}
+
+void Transaction::setChangeManifest(const QVariantMap &manifest)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    updateState([&](State &state) { state.changeManifest = manifest; });
+    notifyPropertyChanged(QApt::ChangeManifestProperty, manifest);
+}
+
+int Transaction::priority()
+{
+    return state()->priority;
+}
+
+void Transaction::setPriority(int priority)
+{
+    if (priority < QApt::BackgroundPriority || priority > QApt::SecurityPriority) {
+        sendErrorReply(QDBusError::Failed);
+        return;
+    }
+
+    // Jumping ahead of, and preempting, other users' transactions is for
+    // administrators
+    if (priority > QApt::InteractivePriority && dbusSenderUid() != 0 &&
+        !QApt::Auth::authorize(dbusActionUri("setpriority"), message().service())) {
+        sendErrorReply(QDBusError::AccessDenied);
+        return;
+    }
+
+    QMutexLocker lock(&m_dataMutex);
+
+    if (state()->status != QApt::SetupStatus) {
+        sendErrorReply(QDBusError::Failed);
+        return;
+    }
+
+    updateState([&](State &state) { state.priority = (QApt::TransactionPriority)priority; });
+    notifyPropertyChanged(QApt::PriorityProperty, priority);
+}
+
+bool Transaction::isPreemptionRequested()
+{
+    return state()->preemptionRequested;
+}
+
+void Transaction::setPreemptionRequested(bool requested)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    updateState([&](State &state) { state.preemptionRequested = requested; });
+
+    lock.unlock();
+    if (requested)
+        wakePausedWaiters();
+}
+
+bool Transaction::isMergeable()
+{
+    return state()->mergeable;
+}
+
+void Transaction::setMergeable(bool mergeable)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    updateState([&](State &state) { state.mergeable = mergeable; });
+}
+
+QList<Transaction *> Transaction::mergedTransactions()
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    return m_merged;
+}
+
+void Transaction::setMergedTransactions(const QList<Transaction *> &merged)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    for (Transaction *trans : m_merged) {
+        disconnect(this, SIGNAL(propertyChanged(int,QDBusVariant)),
+                   trans, SLOT(mirrorProperty(int,QDBusVariant)));
+        disconnect(this, SIGNAL(propertiesChanged(QApt::PropertyMap)),
+                   trans, SLOT(mirrorProperties(QApt::PropertyMap)));
+    }
+
+    m_merged = merged;
+
+    for (Transaction *trans : m_merged) {
+        // Cancelling one of them would cancel them all
+        trans->setCancellable(false);
+
+        // Direct, so that they keep pace with the worker thread
+        connect(this, SIGNAL(propertyChanged(int,QDBusVariant)),
+                trans, SLOT(mirrorProperty(int,QDBusVariant)), Qt::DirectConnection);
+        connect(this, SIGNAL(propertiesChanged(QApt::PropertyMap)),
+                trans, SLOT(mirrorProperties(QApt::PropertyMap)), Qt::DirectConnection);
+    }
+}
+
+void Transaction::notifyPropertyChanged(int property, const QVariant &value)
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    switch (property) {
+    case QApt::StatusDetailsProperty:
+    case QApt::ProgressProperty:
+    case QApt::DownloadSpeedProperty:
+    case QApt::DownloadETAProperty:
+        if (m_updateInterval <= 0)
+            break;
+
+        // The timer lives in the main thread, while most updates come
+        // from the worker thread
+        if (m_pendingProperties.isEmpty())
+            QMetaObject::invokeMethod(this, "scheduleFlush", Qt::QueuedConnection);
+
+        // Newer values replace those still waiting to be sent
+        m_pendingProperties.insert(property, QDBusVariant(value));
+        return;
+    default:
+        break;
+    }
+
+    // Anything else goes out right away, after what was already waiting, so
+    // that clients never see a change before the ones that preceded it
+    flushProperties();
+    emit propertyChanged(property, QDBusVariant(value));
+}
+
+void Transaction::scheduleFlush()
+{
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start(m_updateInterval);
+}
+
+void Transaction::flushProperties()
+{
+    QMutexLocker lock(&m_dataMutex);
+
+    if (m_pendingProperties.isEmpty())
+        return;
+
+    const QApt::PropertyMap properties = m_pendingProperties;
+    m_pendingProperties.clear();
+
+    emit propertiesChanged(properties);
 }
 
 void Transaction::emitIdleTimeout()
 {
     emit idleTimeout(this);
 }
+
+void Transaction::mirrorProperties(const QApt::PropertyMap &properties)
+{
+    for (auto it = properties.constBegin(); it != properties.constEnd(); ++it)
+        mirrorProperty(it.key(), it.value());
+}
+
+void Transaction::mirrorProperty(int property, QDBusVariant value)
+{
+    // The outcome is handed over by the worker once the run is over
+    switch (property) {
+    case QApt::StatusProperty:
+        if (value.variant().toInt() != QApt::FinishedStatus)
+            setStatus((QApt::TransactionStatus)value.variant().toInt());
+        break;
+    case QApt::StatusDetailsProperty:
+        setStatusDetails(value.variant().toString());
+        break;
+    case QApt::ProgressProperty:
+        setProgress(value.variant().toInt());
+        break;
+    case QApt::DownloadSpeedProperty:
+        setDownloadSpeed(value.variant().toULongLong());
+        break;
+    case QApt::DownloadETAProperty:
+        setETA(value.variant().toULongLong());
+        break;
+    case QApt::DownloadProgressBatchProperty:
+        setDownloadProgressBatch(value.variant().value<QApt::DownloadProgressBatch>());
+        break;
+    default:
+        break;
+    }
+}
@@ -23,13 +23,20 @@
 #define TRANSACTION_H
 
 // Qt includes
+#include <QHash>
 #include <QMutex>
 #include <QObject>
+#include <QWaitCondition>
 #include <QDBusContext>
+#include <QDBusUnixFileDescriptor>
 #include <QDBusVariant>
 
+#include <atomic>
+#include <memory>
+
 // Own includes
 #include "downloadprogress.h"
+#include "downloadprogressbatch.h"
 
 class QTimer;
 class TransactionQueue;
@@ -61,6 +68,8 @@ class Transaction : public QObject, protected QDBusContext
     Q_PROPERTY(QString filePath READ filePath)
     Q_PROPERTY(QString errorDetails READ errorDetails)
     Q_PROPERTY(int frontendCaps READ frontendCaps)
+    Q_PROPERTY(QVariantMap changeManifest READ changeManifest)
+    Q_PROPERTY(int priority READ priority)
 public:
     Transaction(TransactionQueue *queue, int userId);
     Transaction(TransactionQueue *queue, int userId,
@@ -81,6 +90,27 @@ public:
     int exitStatus();
     QString medium();
     bool isPaused();
+
+    /**
+     * Blocks until the transaction is no longer paused, i.e. until the
+     * client answers the prompt the transaction is waiting on, or cancels it
+     */
+    void waitWhilePaused();
+
+    /**
+     * Blocks for up to @p msecs, returning early if the transaction is
+     * cancelled or asked to give way to another one
+     *
+     * @return @c true if the wait was cut short
+     */
+    bool waitForInterruption(unsigned long msecs);
+
+    /**
+     * Forwards raw dpkg output to the terminal attached by the client, and
+     * to those of the transactions merged into this one. Output that
+     * doesn't fit in a terminal's socket buffer is dropped.
+     */
+    void writeTerminal(const char *data, int size);
     QString statusDetails();
     int progress();
     QString service() const;
@@ -94,6 +124,10 @@ public:
     bool safeUpgrade() const;
     bool replaceConfFile() const;
     int frontendCaps() const;
+    QVariantMap changeManifest();
+    int priority();
+    bool isPreemptionRequested();
+    bool isMergeable();
 
     void setStatus(QApt::TransactionStatus status);
     void setError(QApt::ErrorCode code);
@@ -104,7 +138,7 @@ public:
     void setStatusDetails(const QString &details);
     void setProgress(int progress);
     void setService(const QString &service);
-    void setDownloadProgress(const QApt::DownloadProgress &downloadProgress);
+    void setDownloadProgressBatch(const QApt::DownloadProgressBatch &batch);
     void setUntrustedPackages(const QStringList &untrusted, bool promptUser);
     void setDownloadSpeed(quint64 downloadSpeed);
     void setETA(quint64 ETA);
@@ -113,6 +147,32 @@ public:
     void setSafeUpgrade(bool safeUpgrade);
     void setConfFileConflict(const QString &currentPath, const QString &newPath);
     void setFrontendCaps(int frontendCaps);
+    void setChangeManifest(const QVariantMap &manifest);
+
+    /**
+     * Asks the worker to interrupt the transaction's archive downloads at
+     * the next item boundary and return it to the queue, to make way for a
+     * transaction with a higher priority
+     */
+    void setPreemptionRequested(bool requested);
+
+    /**
+     * Returns the transactions that the queue merged into this one, to be
+     * committed in the same run
+     */
+    QList<Transaction *> mergedTransactions();
+
+    /**
+     * Merges @p merged into this transaction. They mirror this
+     * transaction's status and progress until they are finished.
+     */
+    void setMergedTransactions(const QList<Transaction *> &merged);
+
+    /**
+     * Keeps the queue from merging this transaction with others, e.g.
+     * after a merged run failed to mark and it has to run on its own
+     */
+    void setMergeable(bool mergeable);
 
 private:
     // Pointers to external containers
@@ -121,39 +181,67 @@ private:
     // Transaction data
     QString m_tid;
     int m_uid;
-    QApt::TransactionRole m_role;
-    QApt::TransactionStatus m_status;
-    QApt::ErrorCode m_error;
-    QString m_locale;
-    QString m_proxy;
-    QString m_debconfPipe;
-    QVariantMap m_packages;
-    bool m_isCancellable;
-    bool m_isCancelled;
-    QApt::ExitStatus m_exitStatus;
-    QString m_medium;
-    bool m_isPaused;
-    QString m_statusDetails;
-    int m_progress;
-    QApt::DownloadProgress m_downloadProgress;
-    QStringList m_untrusted;
-    bool m_allowUntrusted;
-    quint64 m_downloadSpeed;
-    quint64 m_ETA;
-    QString m_filePath;
-    QString m_errorDetails;
-    bool m_safeUpgrade;
-    QString m_currentConfPath;
-    bool m_replaceConfFile;
-    QApt::FrontendCaps m_frontendCaps;
+
+    // What the getters return, except for the atomics below. It is
+    // replaced as a whole on every change, so that reading it (e.g. for
+    // D-Bus property reads while the worker thread is busy) never waits on
+    // the data mutex.
+    struct State {
+        State(QApt::TransactionRole role, const QVariantMap &packages);
+
+        QApt::TransactionRole role;
+        QApt::TransactionStatus status;
+        QApt::ErrorCode error;
+        QString locale;
+        QString proxy;
+        QString debconfPipe;
+        QVariantMap packages;
+        bool isCancellable;
+        bool isCancelled;
+        QApt::ExitStatus exitStatus;
+        QString medium;
+        bool isPaused;
+        QString statusDetails;
+        QApt::DownloadProgress downloadProgress;
+        QStringList untrusted;
+        bool allowUntrusted;
+        QString filePath;
+        QString errorDetails;
+        bool safeUpgrade;
+        QString currentConfPath;
+        bool replaceConfFile;
+        QApt::FrontendCaps frontendCaps;
+        QVariantMap changeManifest;
+        QApt::TransactionPriority priority;
+        bool preemptionRequested;
+        bool mergeable;
+    };
+    std::shared_ptr<const State> m_state;
+    // Set many times a second while downloading, so kept out of the
+    // snapshot to spare a copy of it on every update
+    std::atomic<int> m_progress;
+    std::atomic<quint64> m_downloadSpeed;
+    std::atomic<quint64> m_ETA;
 
     // Other data
+    QList<Transaction *> m_merged;
+    // URIs and short descriptions of the items in download progress batches
+    QHash<quint32, QPair<QString, QString>> m_downloadItems;
+    QDBusUnixFileDescriptor m_terminal;
     QMap<int, QString> m_roleActionMap;
     QTimer *m_idleTimer;
     QMutex m_dataMutex;
+    QMutex m_pauseMutex;
+    QWaitCondition m_pauseCondition;
+    QTimer *m_flushTimer;
+    int m_updateInterval;
+    QApt::PropertyMap m_pendingProperties;
     QString m_service;
 
     // Private functions
+    std::shared_ptr<const State> state() const;
+    template<typename Update>
+    void updateState(Update update);
     int dbusSenderUid() const;
     bool isForeignUser() const;
     void setRole(int role);
@@ -161,10 +249,21 @@ private:
     void setProxy(QString proxy);
     void setDebconfPipe(QString pipe);
     void setPackages(QVariantMap packageList);
+    void setPriority(int priority);
     bool authorizeRun();
+    void wakePausedWaiters();
+
+    /**
+     * Sends a property change to clients. Frequently updated progress
+     * properties are held back and sent together in propertiesChanged()
+     * once per QApt::Worker::PropertyUpdateInterval milliseconds (50 by
+     * default, 0 sends everything right away).
+     */
+    void notifyPropertyChanged(int property, const QVariant &value);
 
 Q_SIGNALS:
     Q_SCRIPTABLE void propertyChanged(int role, QDBusVariant newValue);
+    Q_SCRIPTABLE void propertiesChanged(QApt::PropertyMap properties);
     Q_SCRIPTABLE void finished(int exitStatus);
     Q_SCRIPTABLE void mediumRequired(QString label, QString mountPoint);
     Q_SCRIPTABLE void promptUntrusted(QStringList untrustedPackages);
@@ -178,9 +277,14 @@ public Q_SLOTS:
     void provideMedium(const QString &medium);
     void replyUntrustedPrompt(bool approved);
     void resolveConfigFileConflict(const QString &currentPath, bool replaceFile);
+    void attachTerminal(const QDBusUnixFileDescriptor &fd);
 
 private Q_SLOTS:
     void emitIdleTimeout();
+    void scheduleFlush();
+    void flushProperties();
+    void mirrorProperties(const QApt::PropertyMap &properties);
+    void mirrorProperty(int property, QDBusVariant value);
 };
 
 #endif // TRANSACTION_H
@@ -22,18 +22,61 @@
 #include "transactionqueue.h"
 
 // Qt includes
+#include <QDateTime>
 #include <QStringList>
+#include <QThread>
 #include <QTimer>
 
+// Apt includes
+#include <apt-pkg/configuration.h>
+
 // Own includes
 #include "aptworker.h"
 #include "transaction.h"
 
+// Worker contexts each hold their own package cache, so only a few are kept
+#define MAX_WORKERS 3
+
+namespace {
+
+// Packages are keyed by name, or by name and version for downgrades. The
+// name may or may not carry an architecture, so it is filled in with the
+// native one to compare keys across transactions.
+QString fullPackageName(const QString &key)
+{
+    QString name = key.section(QLatin1Char(','), 0, 0);
+
+    if (name.endsWith(QLatin1String(":native")))
+        name.chop(7);
+
+    if (!name.contains(QLatin1Char(':')))
+        name += QLatin1Char(':') + QString::fromStdString(_config->Find("APT::Architecture"));
+
+    return name;
+}
+
+}
+
 TransactionQueue::TransactionQueue(QObject *parent, AptWorker *worker)
     : QObject(parent)
     , m_worker(worker)
-    , m_activeTransaction(nullptr)
+    , m_lastActiveTimestamp(0)
+{
+    connect(m_worker, SIGNAL(archivesPrefetched(Transaction*)),
+            this, SLOT(onArchivesPrefetched(Transaction*)));
+    connect(m_worker, SIGNAL(archivesFetched(Transaction*)),
+            this, SLOT(onArchivesFetched(Transaction*)));
+    connect(m_worker, SIGNAL(transactionPreempted(Transaction*)),
+            this, SLOT(onTransactionPreempted(Transaction*)));
+}
+
+TransactionQueue::~TransactionQueue()
 {
+    for (AptWorker *worker : m_extraWorkers) {
+        QThread *thread = worker->thread();
+        thread->quit();
+        thread->wait();
+    }
 }
 
 QList<Transaction *> TransactionQueue::transactions() const
@@ -43,7 +86,25 @@ QList<Transaction *> TransactionQueue::transactions() const
 
 Transaction *TransactionQueue::activeTransaction() const
 {
-    return m_activeTransaction;
+    // The oldest of the running transactions
+    for (Transaction *trans : m_queue) {
+        if (m_running.contains(trans))
+            return trans;
+    }
+
+    return nullptr;
+}
+
+QList<Transaction *> TransactionQueue::activeTransactions() const
+{
+    QList<Transaction *> active;
+
+    for (Transaction *trans : m_queue) {
+        if (m_running.contains(trans))
+            active.append(trans);
+    }
+
+    return active;
 }
 
 bool TransactionQueue::isEmpty() const
@@ -51,6 +112,11 @@ bool TransactionQueue::isEmpty() const
     return (m_queue.isEmpty() && m_pending.isEmpty());
 }
 
+quint64 TransactionQueue::lastActiveTimestamp() const
+{
+    return m_lastActiveTimestamp;
+}
+
 Transaction *TransactionQueue::pendingTransactionById(const QString &id) const
 {
     Transaction *transaction = nullptr;
@@ -79,6 +145,150 @@ Transaction *TransactionQueue::transactionById(const QString &id) const
     return transaction;
 }
 
+AptWorker *TransactionQueue::idleWorker()
+{
+    const QList<AptWorker *> busy = m_running.values() + m_prefetching.values();
+
+    if (!busy.contains(m_worker))
+        return m_worker;
+
+    for (AptWorker *worker : m_extraWorkers) {
+        if (!busy.contains(worker))
+            return worker;
+    }
+
+    if (m_extraWorkers.size() + 1 >= MAX_WORKERS)
+        return nullptr;
+
+    // Extra contexts share the package system configuration that the main
+    // worker set up, but have a cache and locks of their own
+    AptWorker *worker = new AptWorker(nullptr, false);
+    QThread *thread = new QThread(this);
+    worker->moveToThread(thread);
+    connect(thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
+    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    thread->start();
+
+    connect(worker, SIGNAL(archivesPrefetched(Transaction*)),
+            this, SLOT(onArchivesPrefetched(Transaction*)));
+    connect(worker, SIGNAL(archivesFetched(Transaction*)),
+            this, SLOT(onArchivesFetched(Transaction*)));
+    connect(worker, SIGNAL(transactionPreempted(Transaction*)),
+            this, SLOT(onTransactionPreempted(Transaction*)));
+
+    QMetaObject::invokeMethod(worker, "init", Qt::QueuedConnection);
+    m_extraWorkers.append(worker);
+
+    return worker;
+}
+
+void TransactionQueue::stopWorker(AptWorker *worker)
+{
+    m_extraWorkers.removeAll(worker);
+    m_doneFetching.remove(worker);
+    worker->thread()->quit();
+}
+
+void TransactionQueue::prefetchNext()
+{
+    // One at a time, so as not to compete with ourselves for bandwidth
+    if (!m_prefetching.isEmpty())
+        return;
+
+    // The archive cache can only take one fetch at a time, and our locks
+    // don't keep the worker threads apart
+    for (auto it = m_running.constBegin(); it != m_running.constEnd(); ++it) {
+        const int locks = AptWorker::locksForRole((QApt::TransactionRole)it.key()->role());
+
+        if ((locks & AptWorker::ArchivesLock) && !m_doneFetching.contains(it.value()))
+            return;
+    }
+
+    for (Transaction *trans : m_queue) {
+        if (m_running.contains(trans) || m_prefetched.contains(trans))
+            continue;
+
+        if (trans->role() != QApt::CommitChangesRole &&
+            trans->role() != QApt::UpgradeSystemRole) {
+            continue;
+        }
+
+        AptWorker *worker = idleWorker();
+        if (!worker)
+            return;
+
+        m_prefetching.insert(trans, worker);
+        m_prefetched.append(trans);
+        QMetaObject::invokeMethod(worker, "prefetchArchives", Qt::QueuedConnection,
+                                  Q_ARG(Transaction *, trans));
+        return;
+    }
+}
+
+bool TransactionQueue::canMerge(Transaction *trans, Transaction *other,
+                                const QSet<QString> &packages) const
+{
+    if (other->role() != QApt::CommitChangesRole || other->isCancelled() ||
+        !other->isMergeable()) {
+        return false;
+    }
+
+    // Same user, and nothing that would make the run look different to them
+    if (other->userId() != trans->userId() ||
+        other->priority() != trans->priority() ||
+        other->locale() != trans->locale() ||
+        other->proxy() != trans->proxy() ||
+        other->debconfPipe() != trans->debconfPipe() ||
+        other->frontendCaps() != trans->frontendCaps()) {
+        return false;
+    }
+
+    for (const QString &key : other->packages().keys()) {
+        if (packages.contains(fullPackageName(key)))
+            return false;
+    }
+
+    return true;
+}
+
+void TransactionQueue::mergeWaitingCommits(Transaction *trans, AptWorker *worker)
+{
+    if (!trans->isMergeable())
+        return;
+
+    QSet<QString> packages;
+    for (const QString &key : trans->packages().keys())
+        packages.insert(fullPackageName(key));
+
+    QList<Transaction *> merged;
+    const int index = m_queue.indexOf(trans);
+
+    for (int i = index + 1; i < m_queue.size(); ++i) {
+        Transaction *other = m_queue.at(i);
+
+        if (m_running.contains(other))
+            continue;
+
+        // Transactions that don't touch dpkg run independently of the merge
+        if (!(AptWorker::locksForRole((QApt::TransactionRole)other->role()) & AptWorker::StatusLock))
+            continue;
+
+        // Merging stops at the first one that doesn't fit, which keeps
+        // everything after it in order
+        if (m_prefetching.contains(other) || !canMerge(trans, other, packages))
+            break;
+
+        for (const QString &key : other->packages().keys())
+            packages.insert(fullPackageName(key));
+
+        merged.append(other);
+        m_running.insert(other, worker);
+    }
+
+    if (!merged.isEmpty())
+        trans->setMergedTransactions(merged);
+}
+
 void TransactionQueue::addPending(Transaction *trans)
 {
     m_pending.append(trans);
@@ -102,13 +312,17 @@ void TransactionQueue::enqueue(QString tid)
 
     connect(trans, SIGNAL(finished(int)), this, SLOT(onTransactionFinished()));
     m_pending.removeAll(trans);
-    m_queue.enqueue(trans);
 
-    if (!m_worker->currentTransaction())
-        runNextTransaction();
-    else {
+    // Ahead of everything with a lower priority, behind the rest
+    int index = 0;
+    while (index < m_queue.size() && m_queue.at(index)->priority() >= trans->priority())
+        ++index;
+    m_queue.insert(index, trans);
+
+    runNextTransactions();
+
+    if (!m_running.contains(trans))
         trans->setStatus(QApt::WaitingStatus);
-    }
 
     emitQueueChanged();
 }
@@ -121,9 +335,8 @@ void TransactionQueue::remove(QString tid)
         return;
 
     m_queue.removeAll(trans);
-
-    if (trans == m_activeTransaction)
-        m_activeTransaction = nullptr;
+    m_running.remove(trans);
+    m_prefetched.removeAll(trans);
 
     emitQueueChanged();
 
@@ -138,20 +351,122 @@ void TransactionQueue::onTransactionFinished()
     if (!trans) // Don't want no trouble...
         return;
 
-    // TODO: Transaction chaining
-
+    m_lastActiveTimestamp = QDateTime::currentMSecsSinceEpoch();
     remove(trans->transactionId());
-    if (m_queue.count())
-        runNextTransaction();
+    runNextTransactions();
     emitQueueChanged();
 }
 
-void TransactionQueue::runNextTransaction()
+void TransactionQueue::onArchivesFetched(Transaction *trans)
+{
+    // Once a transaction is done with its downloads, including the later
+    // batches of a streaming commit, the network and the archive cache are
+    // free for the ones waiting behind it
+    if (!m_running.contains(trans))
+        return;
+
+    m_doneFetching.insert(m_running.value(trans));
+    prefetchNext();
+}
+
+void TransactionQueue::onArchivesPrefetched(Transaction *trans)
+{
+    m_prefetching.remove(trans);
+
+    // A stopped prefetch mustn't cut short the transaction's own run
+    trans->setPreemptionRequested(false);
+
+    runNextTransactions();
+    emitQueueChanged();
+}
+
+void TransactionQueue::runNextTransactions()
+{
+    // Locks held by running transactions, and those wanted by transactions
+    // further up the queue that are still waiting, so that nothing jumps
+    // ahead of an earlier transaction it conflicts with. Anything that
+    // touches dpkg needs the status lock, which keeps those in order.
+    int takenLocks = 0;
+
+    for (Transaction *trans : m_queue) {
+        if (m_running.contains(trans))
+            takenLocks |= AptWorker::locksForRole((QApt::TransactionRole)trans->role());
+    }
+
+    // Prefetches write to the archive cache too
+    if (!m_prefetching.isEmpty())
+        takenLocks |= AptWorker::ArchivesLock;
+
+    for (Transaction *trans : m_queue) {
+        if (m_running.contains(trans))
+            continue;
+
+        const int locks = AptWorker::locksForRole((QApt::TransactionRole)trans->role());
+
+        if (locks & takenLocks) {
+            preemptFor(trans);
+        } else {
+            AptWorker *worker = idleWorker();
+            if (!worker)
+                break;
+
+            m_running.insert(trans, worker);
+            m_doneFetching.remove(worker);
+            if (trans->role() == QApt::CommitChangesRole)
+                mergeWaitingCommits(trans, worker);
+
+            QMetaObject::invokeMethod(worker, "runTransaction", Qt::QueuedConnection,
+                                      Q_ARG(Transaction *, trans));
+        }
+
+        takenLocks |= locks;
+    }
+
+    // Let go of the extra contexts that are left without work
+    const QList<AptWorker *> busy = m_running.values() + m_prefetching.values();
+    for (AptWorker *worker : QList<AptWorker *>(m_extraWorkers)) {
+        if (!busy.contains(worker))
+            stopWorker(worker);
+    }
+}
+
+void TransactionQueue::preemptFor(Transaction *trans)
 {
-    m_activeTransaction = m_queue.head();
+    const int locks = AptWorker::locksForRole((QApt::TransactionRole)trans->role());
+
+    for (auto it = m_running.constBegin(); it != m_running.constEnd(); ++it) {
+        Transaction *running = it.key();
+
+        // Only commit downloads can be picked up again where they left off
+        if (running->role() != QApt::CommitChangesRole &&
+            running->role() != QApt::UpgradeSystemRole) {
+            continue;
+        }
 
-    QMetaObject::invokeMethod(m_worker, "runTransaction", Qt::QueuedConnection,
-                              Q_ARG(Transaction *, m_activeTransaction));
+        if (running->priority() < trans->priority() &&
+            (AptWorker::locksForRole((QApt::TransactionRole)running->role()) & locks)) {
+            running->setPreemptionRequested(true);
+        }
+    }
+
+    // Prefetches hold the archive cache for transactions further down the
+    // queue, and are simply stopped. The transaction fetches the rest
+    // itself when it runs.
+    if (!(locks & AptWorker::ArchivesLock))
+        return;
+
+    for (Transaction *prefetching : m_prefetching.keys()) {
+        if (prefetching->priority() < trans->priority())
+            prefetching->setPreemptionRequested(true);
+    }
+}
+
+void TransactionQueue::onTransactionPreempted(Transaction *trans)
+{
+    m_running.remove(trans);
+
+    runNextTransactions();
+    emitQueueChanged();
 }
 
 void TransactionQueue::emitQueueChanged()
@@ -159,8 +474,8 @@ void TransactionQueue::emitQueueChanged()
     QString tid;
     QStringList queued;
 
-    if (m_activeTransaction)
-        tid = m_activeTransaction->transactionId();
+    if (Transaction *active = activeTransaction())
+        tid = active->transactionId();
 
     for (Transaction *trans : m_queue)
         queued << trans->transactionId();
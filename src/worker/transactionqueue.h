@@ -22,8 +22,11 @@
 #ifndef TRANSACTIONQUEUE_H
 #define TRANSACTIONQUEUE_H
 
+#include <QDBusVariant>
+#include <QHash>
 #include <QObject>
 #include <QQueue>
+#include <QSet>
 
 class AptWorker;
 class Transaction;
@@ -33,20 +36,73 @@ class TransactionQueue : public QObject
     Q_OBJECT
 public:
     TransactionQueue(QObject *parent, AptWorker *worker);
+    ~TransactionQueue();
 
     QList<Transaction *> transactions() const;
     Transaction *activeTransaction() const;
+    QList<Transaction *> activeTransactions() const;
     bool isEmpty() const;
 
+    /**
+     * Returns when a transaction last finished, in milliseconds since the
+     * epoch, or 0 if none has yet
+     */
+    quint64 lastActiveTimestamp() const;
+
 private:
     AptWorker *m_worker;
     QQueue<Transaction *> m_queue;
     QList<Transaction *> m_pending;
-    Transaction *m_activeTransaction;
+    QHash<Transaction *, AptWorker *> m_running;
+    QList<AptWorker *> m_extraWorkers;
+    QHash<Transaction *, AptWorker *> m_prefetching;
+    QList<Transaction *> m_prefetched;
+    // Workers whose running transaction is past its downloads
+    QSet<AptWorker *> m_doneFetching;
+    quint64 m_lastActiveTimestamp;
 
     Transaction *pendingTransactionById(const QString &id) const;
     Transaction *transactionById(const QString &id) const;
-    
+
+    /**
+     * Returns a worker context that is not running a transaction, starting
+     * a new one if there is room for it, or @c nullptr if there is none.
+     */
+    AptWorker *idleWorker();
+
+    /**
+     * Stops a worker context started by idleWorker()
+     */
+    void stopWorker(AptWorker *worker);
+
+    /**
+     * Returns whether the waiting transaction @p other can be committed in
+     * the same run as @p trans, given the @p packages that run already acts
+     * on
+     */
+    bool canMerge(Transaction *trans, Transaction *other,
+                  const QSet<QString> &packages) const;
+
+    /**
+     * Merges the commits waiting behind @p trans that can go in the same
+     * dpkg run in to it, and hands them to @p worker along with it
+     */
+    void mergeWaitingCommits(Transaction *trans, AptWorker *worker);
+
+    /**
+     * Asks running transactions with a lower priority than @p trans that
+     * hold locks it needs to give way at the end of their current download,
+     * and stops prefetches for lower priority transactions if it needs the
+     * archive cache
+     */
+    void preemptFor(Transaction *trans);
+
+    /**
+     * Starts downloading archives for the next waiting transaction that
+     * needs them, while the network would otherwise sit idle
+     */
+    void prefetchNext();
+
 signals:
     void queueChanged(const QString &active,
                       const QStringList &queued);
@@ -59,7 +115,10 @@ public slots:
 
 private slots:
     void onTransactionFinished();
-    void runNextTransaction();
+    void onArchivesFetched(Transaction *trans);
+    void onArchivesPrefetched(Transaction *trans);
+    void onTransactionPreempted(Transaction *trans);
+    void runNextTransactions();
     void emitQueueChanged();
 };
 
@@ -24,7 +24,9 @@
 #include <QCoreApplication>
 #include <QDebug>
 #include <QEventLoop>
+#include <QMutex>
 #include <QStringBuilder>
+#include <QWaitCondition>
 
 // Apt-pkg includes
 #include <apt-pkg/error.h>
@@ -35,16 +37,155 @@
 #include "aptworker.h"
 #include "transaction.h"
 
+#include <stdlib.h>
 #include <unistd.h>
 
 using namespace std;
 
+namespace {
+
+// The http method goes by the latter for https URIs
+const char *const s_proxyVariables[] = { "http_proxy", "https_proxy" };
+const int s_proxyVariableCount = sizeof(s_proxyVariables) / sizeof(s_proxyVariables[0]);
+
+// Shared by every MethodEnvironment, guarded by MethodEnvironment::mutex()
+struct SharedEnvironment {
+    SharedEnvironment() : holders(0), proxySet(false) {}
+
+    QWaitCondition released;
+    int holders;
+    QByteArray proxy;
+    // The worker's own proxy variables, while another proxy is set
+    bool proxySet;
+    QByteArray oldValues[s_proxyVariableCount];
+};
+
+SharedEnvironment *sharedEnvironment()
+{
+    static SharedEnvironment environment;
+
+    return &environment;
+}
+
+}
+
+MethodEnvironment::MethodEnvironment()
+    : m_held(false)
+{
+}
+
+MethodEnvironment::~MethodEnvironment()
+{
+    release();
+}
+
+void MethodEnvironment::hold(const QString &proxy)
+{
+    if (m_held)
+        return;
+
+    const QByteArray value = proxy.toLatin1();
+    SharedEnvironment *shared = sharedEnvironment();
+
+    QMutexLocker locker(mutex());
+    while (shared->holders > 0 && shared->proxy != value)
+        shared->released.wait(mutex());
+
+    if (shared->holders++ == 0) {
+        shared->proxy = value;
+        if (!value.isEmpty()) {
+            for (int i = 0; i < s_proxyVariableCount; ++i) {
+                shared->oldValues[i] = qgetenv(s_proxyVariables[i]);
+                qputenv(s_proxyVariables[i], value);
+            }
+            shared->proxySet = true;
+        }
+    }
+
+    m_held = true;
+}
+
+void MethodEnvironment::release()
+{
+    if (!m_held)
+        return;
+
+    SharedEnvironment *shared = sharedEnvironment();
+
+    QMutexLocker locker(mutex());
+    m_held = false;
+
+    if (--shared->holders > 0)
+        return;
+
+    if (shared->proxySet) {
+        for (int i = 0; i < s_proxyVariableCount; ++i) {
+            if (shared->oldValues[i].isNull())
+                qunsetenv(s_proxyVariables[i]);
+            else
+                qputenv(s_proxyVariables[i], shared->oldValues[i]);
+        }
+
+        shared->proxySet = false;
+    }
+
+    shared->proxy.clear();
+    shared->released.wakeAll();
+}
+
+QProcessEnvironment MethodEnvironment::processEnvironment()
+{
+    SharedEnvironment *shared = sharedEnvironment();
+
+    QMutexLocker locker(mutex());
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+
+    if (!shared->proxySet)
+        return environment;
+
+    for (int i = 0; i < s_proxyVariableCount; ++i) {
+        const QString name = QLatin1String(s_proxyVariables[i]);
+        if (shared->oldValues[i].isNull())
+            environment.remove(name);
+        else
+            environment.insert(name, QString::fromLatin1(shared->oldValues[i]));
+    }
+
+    return environment;
+}
+
+QMutex *MethodEnvironment::mutex()
+{
+    static QMutex mutex;
+
+    return &mutex;
+}
+
+void MethodEnvironment::resetProxy()
+{
+    // No locking, the child only has a copy of the parent's memory
+    const SharedEnvironment *shared = sharedEnvironment();
+
+    if (!shared->proxySet)
+        return;
+
+    for (int i = 0; i < s_proxyVariableCount; ++i) {
+        if (shared->oldValues[i].isNull())
+            unsetenv(s_proxyVariables[i]);
+        else
+            setenv(s_proxyVariables[i], shared->oldValues[i].constData(), 1);
+    }
+}
+
 WorkerAcquire::WorkerAcquire(QObject *parent, int begin, int end)
         : QObject(parent)
         , m_calculatingSpeed(true)
         , m_progressBegin(begin)
         , m_progressEnd(end)
         , m_lastProgress(0)
+        , m_preempted(false)
+        , m_stopped(false)
+        , m_nextItemId(0)
 {
     MorePulses = true;
 }
@@ -52,14 +193,30 @@ WorkerAcquire::WorkerAcquire(QObject *parent, int begin, int end)
 void WorkerAcquire::setTransaction(Transaction *trans)
 {
     m_trans = trans;
-    if (!trans->proxy().isEmpty())
-        setenv("http_proxy", m_trans->proxy().toLatin1(), 1);
+}
+
+void WorkerAcquire::holdEnvironment()
+{
+    m_environment.hold(m_trans->proxy());
+}
+
+bool WorkerAcquire::isPreempted() const
+{
+    return m_preempted;
+}
+
+void WorkerAcquire::stop()
+{
+    m_stopped = true;
 }
 
 void WorkerAcquire::Start()
 {
     // Cleanup from old fetches
     m_calculatingSpeed = true;
+    m_preempted = false;
+    m_items.clear();
+    m_batch.clear();
 
     m_trans->setCancellable(true);
     m_trans->setStatus(QApt::DownloadingStatus);
@@ -89,6 +246,11 @@ void WorkerAcquire::Done(pkgAcquire::ItemDesc &item)
    Update = true;
 
    updateStatus(item);
+
+   // Give way at an item boundary, so that only the items that are still
+   // in flight have to be resumed later
+   if (m_trans->isPreemptionRequested())
+       m_preempted = true;
 }
 
 void WorkerAcquire::Fail(pkgAcquire::ItemDesc &item)
@@ -115,9 +277,15 @@ void WorkerAcquire::Fail(pkgAcquire::ItemDesc &item)
 
 void WorkerAcquire::Stop()
 {
+    // Items that finished after the last pulse
+    sendBatch();
+
     m_trans->setProgress(m_progressEnd);
     m_trans->setCancellable(false);
     pkgAcquireStatus::Stop();
+
+    // No more methods will be started for this fetch
+    m_environment.release();
 }
 
 bool WorkerAcquire::MediaChange(string Media, string Drive)
@@ -132,8 +300,7 @@ bool WorkerAcquire::MediaChange(string Media, string Drive)
     m_trans->setStatus(QApt::WaitingMediumStatus);
 
     // Wait until the media is provided or the user cancels
-    while (m_trans->isPaused())
-        usleep(200000);
+    m_trans->waitWhilePaused();
 
     m_trans->setStatus(QApt::DownloadingStatus);
 
@@ -143,7 +310,7 @@ bool WorkerAcquire::MediaChange(string Media, string Drive)
 
 bool WorkerAcquire::Pulse(pkgAcquire *Owner)
 {
-    if (m_trans->isCancelled())
+    if (m_trans->isCancelled() || m_preempted || m_stopped)
         return false;
 
     pkgAcquireStatus::Pulse(Owner);
@@ -162,6 +329,8 @@ bool WorkerAcquire::Pulse(pkgAcquire *Owner)
         updateStatus(*iter->CurrentItem);
     }
 
+    sendBatch();
+
     int percentage = qRound(double((CurrentBytes + CurrentItems) * 100.0)/double (TotalBytes + TotalItems));
     int progress = 0;
     // work-around a stupid problem with libapt-pkg
@@ -197,47 +366,85 @@ bool WorkerAcquire::Pulse(pkgAcquire *Owner)
 
 void WorkerAcquire::updateStatus(const pkgAcquire::ItemDesc &Itm)
 {
-    QString URI = QString::fromStdString(Itm.Description);
+    QApt::DownloadProgressRecord record;
     int status = (int)Itm.Owner->Status;
-    QApt::DownloadStatus downloadStatus = QApt::IdleState;
-    QString shortDesc = QString::fromStdString(Itm.ShortDesc);
-    quint64 fileSize = Itm.Owner->FileSize;
-    quint64 fetchedSize = Itm.Owner->PartialSize;
-    QString errorMsg = QString::fromStdString(Itm.Owner->ErrorText);
-    QString message;
+    record.fileSize = Itm.Owner->FileSize;
+    record.fetchedSize = Itm.Owner->PartialSize;
 
     // Status mapping
     switch (status) {
     case pkgAcquire::Item::StatIdle:
-        downloadStatus = QApt::IdleState;
+        record.status = QApt::IdleState;
         break;
     case pkgAcquire::Item::StatFetching:
-        downloadStatus = QApt::FetchingState;
+        record.status = QApt::FetchingState;
         break;
     case pkgAcquire::Item::StatDone:
-        downloadStatus = QApt::DoneState;
-        fetchedSize = fileSize;
+        record.status = QApt::DoneState;
+        record.fetchedSize = record.fileSize;
         break;
     case pkgAcquire::Item::StatError:
-        downloadStatus = QApt::ErrorState;
+        record.status = QApt::ErrorState;
         break;
     case pkgAcquire::Item::StatAuthError:
-        downloadStatus = QApt::AuthErrorState;
+        record.status = QApt::AuthErrorState;
         break;
     case pkgAcquire::Item::StatTransientNetworkError:
-        downloadStatus = QApt::NetworkErrorState;
+        record.status = QApt::NetworkErrorState;
         break;
     default:
+        record.status = QApt::IdleState;
         break;
     }
 
-    if (downloadStatus == QApt::DoneState && errorMsg.size())
-        message = errorMsg;
+    if (record.status == QApt::DoneState && !Itm.Owner->ErrorText.empty())
+        record.statusMessage = QString::fromStdString(Itm.Owner->ErrorText);
     else if (!Itm.Owner->ActiveSubprocess.empty())
-        message = QString::fromStdString(Itm.Owner->ActiveSubprocess);
+        record.statusMessage = QString::fromStdString(Itm.Owner->ActiveSubprocess);
+
+    // An item moving on to another URI (e.g. the next stage of a pdiff)
+    // counts as a new one for the client
+    auto item = m_items.find(Itm.Owner);
+    if (item == m_items.end() || item->description != Itm.Description) {
+        ItemState state;
+        state.id = ++m_nextItemId;
+        state.description = Itm.Description;
+        state.status = -1;
+        item = m_items.insert(Itm.Owner, state);
+    }
+    record.id = item->id;
+
+    // The URI goes along with every change of status, so that clients
+    // that attach part way through pick it up too
+    if (item->status != record.status) {
+        item->status = record.status;
+
+        record.uri = QString::fromStdString(Itm.Description);
+        record.shortDescription = QString::fromStdString(Itm.ShortDesc);
+    }
 
-    QApt::DownloadProgress dp(URI, downloadStatus, shortDesc,
-                              fileSize, fetchedSize, message);
+    // Only the latest state of an item is sent, but keep the URI if it was
+    // due in this batch
+    for (QApt::DownloadProgressRecord &queued : m_batch) {
+        if (queued.id != record.id)
+            continue;
+
+        if (record.uri.isEmpty()) {
+            record.uri = queued.uri;
+            record.shortDescription = queued.shortDescription;
+        }
+        queued = record;
+        return;
+    }
+
+    m_batch.append(record);
+}
+
+void WorkerAcquire::sendBatch()
+{
+    if (m_batch.isEmpty())
+        return;
 
-    m_trans->setDownloadProgress(dp);
+    m_trans->setDownloadProgressBatch(m_batch);
+    m_batch.clear();
 }
@@ -22,13 +22,61 @@
 #define WORKERACQUIRE_H
 
 // Qt includes
+#include <QByteArray>
+#include <QHash>
 #include <QObject>
+#include <QProcessEnvironment>
 
 // Apt-pkg includes
 #include <apt-pkg/acquire.h>
 
+#include <atomic>
+
+// Own includes
+#include "downloadprogressbatch.h"
+
+class QMutex;
 class Transaction;
 
+/**
+ * The environment the download methods of one fetch are started with.
+ *
+ * apt only hands a proxy to its methods through the global configuration
+ * or through the environment they inherit, and changing either would
+ * affect every other fetch in the worker. So the environment is held for
+ * the whole fetch: from hold(), right before pkgAcquire::Run(), until its
+ * status calls release() from Stop(), so that methods started late in the
+ * fetch, e.g. for a redirect to another host, still get the proxy. Fetches
+ * with the same proxy share the environment, a fetch with another proxy
+ * waits for them to finish.
+ *
+ * Anything else that starts a process should use processEnvironment(),
+ * or hold mutex() while forking and call resetProxy() in the child, so
+ * that it does not inherit the proxy of a running fetch.
+ */
+class MethodEnvironment
+{
+public:
+    MethodEnvironment();
+    ~MethodEnvironment();
+
+    void hold(const QString &proxy);
+    void release();
+
+    /// The worker's own environment, without the proxy of a running fetch
+    static QProcessEnvironment processEnvironment();
+
+    /// Locks the environment against changes
+    static QMutex *mutex();
+    /// Restores the worker's own proxy in a child forked under mutex()
+    static void resetProxy();
+
+private:
+    Q_DISABLE_COPY(MethodEnvironment)
+
+    bool m_held;
+};
+
 class WorkerAcquire : public QObject, public pkgAcquireStatus
 {
     Q_OBJECT
@@ -47,12 +95,44 @@ public:
 
     void setTransaction(Transaction *trans);
 
+    /// Call right before running a fetch with this status
+    void holdEnvironment();
+
+    /**
+     * Whether the fetch was stopped to make way for a transaction with a
+     * higher priority
+     */
+    bool isPreempted() const;
+
+    /**
+     * Stops the fetch at the next pulse. Can be called from any thread.
+     */
+    void stop();
+
 private:
     Transaction *m_trans;
     bool m_calculatingSpeed;
     int m_progressBegin;
     int m_progressEnd;
     int m_lastProgress;
+    bool m_preempted;
+    std::atomic<bool> m_stopped;
+    MethodEnvironment m_environment;
+
+    struct ItemState {
+        quint32 id;
+        std::string description;
+        int status;
+    };
+
+    // IDs handed out to items, so that their URIs are only sent when they
+    // start out or change status
+    QHash<pkgAcquire::Item *, ItemState> m_items;
+    quint32 m_nextItemId;
+    // Items that changed since the last pulse
+    QApt::DownloadProgressBatch m_batch;
+
+    void sendBatch();
 
 private Q_SLOTS:
     void updateStatus(const pkgAcquire::ItemDesc &Itm);
@@ -21,6 +21,7 @@
 #include "workerdaemon.h"
 
 // Qt includes
+#include <QDBusMetaType>
 #include <QThread>
 #include <QTimer>
 
@@ -58,6 +59,10 @@ WorkerDaemon::WorkerDaemon(int &argc, char **argv)
             Qt::QueuedConnection);
     qRegisterMetaType<Transaction *>("Transaction *");
     QApt::DownloadProgress::registerMetaTypes();
+    qRegisterMetaType<QApt::PropertyMap>("QApt::PropertyMap");
+    qDBusRegisterMetaType<QApt::PropertyMap>();
+    qDBusRegisterMetaType<QApt::DownloadProgressRecord>();
+    qDBusRegisterMetaType<QApt::DownloadProgressBatch>();
 
     // Start up D-Bus service
     new WorkerAdaptor(this);
@@ -83,9 +88,22 @@ WorkerDaemon::WorkerDaemon(int &argc, char **argv)
 
 void WorkerDaemon::checkIdle()
 {
+    // In standby mode the worker keeps its warm cache around for longer,
+    // or for good with a negative timeout
+    const int standbyTimeout = m_worker->standbyTimeout();
+    if (standbyTimeout < 0)
+        return;
+
+    const quint64 idleTimeout = standbyTimeout ? quint64(standbyTimeout) * 1000 : IDLE_TIMEOUT;
+
+    // Transactions may also have run alongside the worker, in the queue's
+    // extra worker contexts
+    const quint64 lastActive = qMax(m_worker->lastActiveTimestamp(),
+                                    m_queue->lastActiveTimestamp());
+
     quint64 currentTime = QDateTime::currentMSecsSinceEpoch();
     if (!m_worker->currentTransaction() &&
-        currentTime - m_worker->lastActiveTimestamp() > IDLE_TIMEOUT &&
+        currentTime - lastActive > idleTimeout &&
         m_queue->isEmpty()) {
         m_worker->quit();
     }
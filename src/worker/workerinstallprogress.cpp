@@ -21,15 +21,17 @@
 
 #include "workerinstallprogress.h"
 
+#include <QMutex>
 #include <QStringBuilder>
 #include <QStringList>
-#include <QTextCodec>
 #include <QDebug>
 
 #include <apt-pkg/error.h>
 #include <apt-pkg/install-progress.h>
 
+#include <clocale>
 #include <errno.h>
+#include <poll.h>
 #include <sys/statvfs.h>
 #include <sys/statfs.h>
 #include <sys/wait.h>
@@ -41,6 +43,7 @@
 #include <stdlib.h>
 
 #include "transaction.h"
+#include "workeracquire.h"
 
 using namespace std;
 
@@ -50,39 +53,43 @@ WorkerInstallProgress::WorkerInstallProgress(int begin, int end)
         , m_progressBegin(begin)
         , m_progressEnd(end)
 {
-    setenv("APT_LISTBUGS_FRONTEND", "none", 1);
-    setenv("APT_LISTCHANGES_FRONTEND", "debconf", 1);
 }
 
 void WorkerInstallProgress::setTransaction(Transaction *trans)
 {
     m_trans = trans;
-    std::setlocale(LC_ALL, m_trans->locale().toLatin1());
-
-    // FIXME: bloody workaround.
-    //        Since QLocale::system and consequently QTextCodec::forLocale is
-    //        set way before we get here there's a need to manually override
-    //        the already set default codec with that is requested by the client.
-    //        Since the client talks to us about posix locales however we cannot
-    //        expect a reliable mapping from split(.).last() to a proper codec.
-    //        Also there is no explicit Qt api to translate a given posix locale
-    //        to QLocale & QTextCodec.
-    //        Ultimately transactions should get new properties for QLocale::name
-    //        and QTextCodec::name, assuming generally meaningful values we can
-    //        through those properties accurately recreate the client locale env.
-    if (m_trans->locale().contains(QChar('.'))) {
-        QTextCodec *codec = QTextCodec::codecForName(m_trans->locale().split(QChar('.')).last().toUtf8());
-        QTextCodec::setCodecForLocale(codec);
-    }
+    m_locale = m_trans->locale().toLatin1();
+
+    m_environment.clear();
+    m_environment.append(qMakePair(QByteArray("PATH"),
+                                   QByteArray("/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin")));
+    m_environment.append(qMakePair(QByteArray("APT_LISTBUGS_FRONTEND"), QByteArray("none")));
+    m_environment.append(qMakePair(QByteArray("APT_LISTCHANGES_FRONTEND"), QByteArray("debconf")));
 
     if ((trans->frontendCaps() & QApt::DebconfCap) && !trans->debconfPipe().isEmpty()) {
-        setenv("DEBIAN_FRONTEND", "passthrough", 1);
-        setenv("DEBCONF_PIPE", trans->debconfPipe().toLatin1(), 1);
+        m_environment.append(qMakePair(QByteArray("DEBIAN_FRONTEND"), QByteArray("passthrough")));
+        m_environment.append(qMakePair(QByteArray("DEBCONF_PIPE"), trans->debconfPipe().toLatin1()));
     } else {
-        setenv("DEBIAN_FRONTEND", "noninteractive", 1);
+        m_environment.append(qMakePair(QByteArray("DEBIAN_FRONTEND"), QByteArray("noninteractive")));
     }
 }
 
+QProcessEnvironment WorkerInstallProgress::processEnvironment() const
+{
+    // Without the proxy of a fetch that may be running meanwhile
+    QProcessEnvironment environment = MethodEnvironment::processEnvironment();
+
+    for (const QPair<QByteArray, QByteArray> &variable : m_environment) {
+        environment.insert(QString::fromLatin1(variable.first), QString::fromLatin1(variable.second));
+    }
+
+    // There's no setlocale() in a QProcess child, so go by the variable
+    if (!m_locale.isEmpty())
+        environment.insert(QLatin1String("LC_ALL"), QString::fromLatin1(m_locale));
+
+    return environment;
+}
+
 pkgPackageManager::OrderResult WorkerInstallProgress::start(pkgPackageManager *pm)
 {
     m_trans->setStatus(QApt::CommittingStatus);
@@ -101,7 +108,11 @@ pkgPackageManager::OrderResult WorkerInstallProgress::start(pkgPackageManager *p
     }
 
     int pty_master;
-    m_child_id = forkpty(&pty_master, 0, 0, 0);
+    {
+        // Don't copy an environment that is being changed for a fetch
+        QMutexLocker locker(MethodEnvironment::mutex());
+        m_child_id = forkpty(&pty_master, 0, 0, 0);
+    }
 
     if (m_child_id == -1) {
         return res;
@@ -109,6 +120,12 @@ pkgPackageManager::OrderResult WorkerInstallProgress::start(pkgPackageManager *p
         // close pipe we don't need
         close(readFromChildFD[0]);
 
+        MethodEnvironment::resetProxy();
+        std::setlocale(LC_ALL, m_locale.constData());
+        for (const QPair<QByteArray, QByteArray> &variable : m_environment) {
+            setenv(variable.first.constData(), variable.second.constData(), 1);
+        }
+
         APT::Progress::PackageManagerProgressFd progress(readFromChildFD[1]);
         res = pm->DoInstallPostFork(&progress);
 
@@ -120,25 +137,51 @@ pkgPackageManager::OrderResult WorkerInstallProgress::start(pkgPackageManager *p
         _exit(res);
     }
 
+    // Only the child writes progress, so the pipe hangs up once it is done
+    close(readFromChildFD[1]);
+
     // make it nonblocking
     fcntl(readFromChildFD[0], F_SETFL, O_NONBLOCK);
     fcntl(pty_master, F_SETFL, O_NONBLOCK);
 
-    // Update the interface until the child dies
+    pollfd fds[2];
+    fds[0].fd = readFromChildFD[0];
+    fds[1].fd = pty_master;
+    for (pollfd &pfd : fds)
+        pfd.events = POLLIN;
+
+    // Update the interface until the child dies. Maintainer scripts can
+    // leave daemons behind that keep the fds open, so the child is reaped
+    // by pid rather than by waiting for both ends to hang up.
     int ret;
     char masterbuf[1024];
     while (waitpid(m_child_id, &ret, WNOHANG) == 0) {
-        // Read dpkg's raw output
-        while(read(pty_master, masterbuf, sizeof(masterbuf)) > 0);
+        if (poll(fds, 2, 500) < 0)
+            continue;
+
+        // Pass dpkg's raw output on to the client's terminal, if any
+        if (fds[1].revents & POLLIN) {
+            ssize_t length;
+            while ((length = read(pty_master, masterbuf, sizeof(masterbuf))) > 0)
+                m_trans->writeTerminal(masterbuf, length);
+        }
 
         // Update high-level status info
-        updateInterface(readFromChildFD[0], pty_master);
+        if (fds[0].revents & POLLIN)
+            updateInterface(readFromChildFD[0], pty_master);
+
+        for (pollfd &pfd : fds) {
+            if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+                pfd.fd = -1;
+        }
     }
 
+    // Pick up whatever was written right before the child exited
+    updateInterface(readFromChildFD[0], pty_master);
+
     res = (pkgPackageManager::OrderResult)WEXITSTATUS(ret);
 
     close(readFromChildFD[0]);
-    close(readFromChildFD[1]);
     close(pty_master);
 
     return res;
@@ -146,86 +189,45 @@ pkgPackageManager::OrderResult WorkerInstallProgress::start(pkgPackageManager *p
 
 void WorkerInstallProgress::updateInterface(int fd, int writeFd)
 {
-    char buf[2];
-    static char line[1024] = "";
-
-    while (1) {
-        int len = read(fd, buf, 1);
-
-        // Status message didn't change
-        if (len < 1) {
-            break;
-        }
-
-        if (buf[0] == '\n') {
-            const QStringList list = QString::fromUtf8(line).split(QLatin1Char(':'));
-            const QString status = list.at(0);
-            const QString package = list.at(1);
-            QString percent = list.at(2);
-            QString str = list.at(3);
-            // If str legitimately had a ':' in it (such as a package version)
-            // we need to retrieve the next string in the list.
-            if (list.count() == 5) {
-                str += QString(':' % list.at(4));
-            }
-
-            if (package.isEmpty() || status.isEmpty()) {
-                continue;
+    m_statusReader.readFrom(fd);
+    m_statusReader.takeLines([this, writeFd](const DpkgStatusLine &line) {
+        const QString str = line.message.toString();
+
+        if (line.status.startsWith("pmerror")) {
+            // Append error string to existing error details
+            m_trans->setErrorDetails(m_trans->errorDetails() % line.package.toString() % '\n' % str % "\n\n");
+        } else if (line.status.startsWith("pmconffile")) {
+            // From what I understand, the original file starts after the ' character ('\'') and
+            // goes to a second ' character. The new conf file starts at the next ' and goes to
+            // the next '.
+            QStringList strList = str.split('\'');
+            QString oldFile = strList.value(1);
+            QString newFile = strList.value(2);
+
+            // Prompt for which file to use if the frontend supports that
+            if (m_trans->frontendCaps() & QApt::ConfigPromptCap) {
+                m_trans->setConfFileConflict(oldFile, newFile);
+                m_trans->setStatus(QApt::WaitingConfigFilePromptStatus);
+
+                m_trans->waitWhilePaused();
             }
 
-            if (status.contains(QLatin1String("pmerror"))) {
-                // Append error string to existing error details
-                m_trans->setErrorDetails(m_trans->errorDetails() % package % '\n' % str % "\n\n");
-            } else if (status.contains(QLatin1String("pmconffile"))) {
-                // From what I understand, the original file starts after the ' character ('\'') and
-                // goes to a second ' character. The new conf file starts at the next ' and goes to
-                // the next '.
-                QStringList strList = str.split('\'');
-                QString oldFile = strList.at(1);
-                QString newFile = strList.at(2);
-
-                // Prompt for which file to use if the frontend supports that
-                if (m_trans->frontendCaps() & QApt::ConfigPromptCap) {
-                    m_trans->setConfFileConflict(oldFile, newFile);
-                    m_trans->setStatus(QApt::WaitingConfigFilePromptStatus);
-
-                    while (m_trans->isPaused())
-                        usleep(200000);
-                }
-
-                m_trans->setStatus(QApt::CommittingStatus);
-
-                if (m_trans->replaceConfFile()) {
-                    ssize_t reply = write(writeFd, "Y\n", 2);
-                    Q_UNUSED(reply);
-                } else {
-                    ssize_t reply = write(writeFd, "N\n", 2);
-                    Q_UNUSED(reply);
-                }
-            } else {
-                m_startCounting = true;
-            }
+            m_trans->setStatus(QApt::CommittingStatus);
 
-            int percentage;
-            int progress;
-            if (percent.contains(QLatin1Char('.'))) {
-                QStringList percentList = percent.split(QLatin1Char('.'));
-                percentage = percentList.at(0).toInt();
+            if (m_trans->replaceConfFile()) {
+                ssize_t reply = write(writeFd, "Y\n", 2);
+                Q_UNUSED(reply);
             } else {
-                percentage = percent.toInt();
+                ssize_t reply = write(writeFd, "N\n", 2);
+                Q_UNUSED(reply);
             }
-
-            progress = qRound(qreal(m_progressBegin + qreal(percentage / 100.0) * (m_progressEnd - m_progressBegin)));
-
-            m_trans->setProgress(progress);
-            m_trans->setStatusDetails(str);
-            // clean-up
-            line[0] = 0;
         } else {
-            buf[1] = 0;
-            strcat(line, buf);
+            m_startCounting = true;
         }
-    }
-    // 30 frames per second
-    usleep(1000000/30);
+
+        int progress = qRound(qreal(m_progressBegin + qreal(line.percentage() / 100.0) * (m_progressEnd - m_progressBegin)));
+
+        m_trans->setProgress(progress);
+        m_trans->setStatusDetails(str);
+    });
 }
@@ -22,8 +22,15 @@
 #ifndef WORKERINSTALLPROGRESS_H
 #define WORKERINSTALLPROGRESS_H
 
+#include <QByteArray>
+#include <QPair>
+#include <QProcessEnvironment>
+#include <QVector>
+
 #include <apt-pkg/packagemanager.h>
 
+#include "dpkgstatusreader.h"
+
 class Transaction;
 
 class WorkerInstallProgress
@@ -34,13 +41,24 @@ public:
     void setTransaction(Transaction *trans);
     pkgPackageManager::OrderResult start(pkgPackageManager *pm);
 
+    /**
+     * The environment dpkg should run in for the transaction, for starting
+     * it in a child process other than through start()
+     */
+    QProcessEnvironment processEnvironment() const;
+
 private:
     Transaction *m_trans;
+    // Set in the child only, so that transactions don't change the
+    // worker's own locale and environment
+    QByteArray m_locale;
+    QVector<QPair<QByteArray, QByteArray> > m_environment;
 
     pid_t m_child_id;
     bool m_startCounting;
     int m_progressBegin;
     int m_progressEnd;
+    DpkgStatusReader m_statusReader;
 
     void updateInterface(int fd, int writeFd);
 };